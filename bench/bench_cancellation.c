@@ -0,0 +1,336 @@
+/*****************************************************************************\
+ *                                                                           *\
+ *  This file is part of the Verificarlo project,                            *\
+ *  under the Apache License v2.0 with LLVM Exceptions.                      *\
+ *  SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception.                 *\
+ *  See https://llvm.org/LICENSE.txt for license information.                *\
+ *                                                                           *\
+ *  Copyright (c) 2019-2022                                                  *\
+ *     Verificarlo Contributors                                              *\
+ *                                                                           *\
+ ****************************************************************************/
+// Microbenchmark suite for the cancellation backend.
+//
+// The exported callbacks are called directly, as verificarlo would do,
+// over synthetic workloads: no cancellation, 1% and 100% of cancellations,
+// 100% of total cancellations, whose results are zero, and 100% of
+// cancellations among the smallest normal numbers, whose results are
+// subnormal, in binary32 and binary64, from 1 up to max_threads threads (by
+// powers of two). Each run reports the time per operation seen by one
+// thread and the cancellation events per second over all threads. The
+// random numbers drawn are counted by the backends built with
+// --enable-self-profiling, in their report at exit. Only the public API is
+// used, so the same binary can be relinked against an older
+// libinterflop_cancellation to compare throughputs before and after a
+// change.
+//
+// Usage: bench_cancellation [iterations [max_threads]]
+
+#include <err.h>
+#include <errno.h>
+#include <float.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "interflop-stdlib/interflop.h"
+#include "interflop-stdlib/interflop_stdlib.h"
+#include "interflop_cancellation.h"
+
+#define BENCH_ITERATIONS_DEFAULT 10000000UL
+#define BENCH_THREADS_DEFAULT 4
+/* a multiple of 100, so that the sparse workload has exactly 1% of
+ * cancellations */
+#define BENCH_OPERANDS 1000
+
+/* stdlib handlers required by the backend */
+static File *_bench_fopen(const char *path, const char *mode, int *error) {
+  FILE *f = fopen(path, mode);
+  *error = (f == NULL) ? errno : 0;
+  return f;
+}
+
+static void _bench_panic(const char *msg) {
+  fprintf(stderr, "%s", msg);
+  exit(1);
+}
+
+static long _bench_strtol(const char *nptr, char **endptr, int *error) {
+  errno = 0;
+  long val = strtol(nptr, endptr, 10);
+  *error = errno;
+  return val;
+}
+
+static double _bench_strtod(const char *nptr, char **endptr, int *error) {
+  errno = 0;
+  double val = strtod(nptr, endptr);
+  *error = errno;
+  return val;
+}
+
+static int _bench_fclose(File *stream, int *error) {
+  const int ret = fclose((FILE *)stream);
+  *error = (ret != 0) ? errno : 0;
+  return ret;
+}
+
+static char *_bench_fgets(char *s, int size, File *stream) {
+  return fgets(s, size, (FILE *)stream);
+}
+
+static int _bench_gettid(void) { return syscall(SYS_gettid); }
+
+static void _bench_set_handlers(void) {
+  interflop_set_handler("malloc", malloc);
+  interflop_set_handler("exit", exit);
+  interflop_set_handler("fclose", _bench_fclose);
+  interflop_set_handler("fgets", _bench_fgets);
+  interflop_set_handler("fopen", _bench_fopen);
+  interflop_set_handler("panic", _bench_panic);
+  interflop_set_handler("fprintf", fprintf);
+  interflop_set_handler("getenv", getenv);
+  interflop_set_handler("gettid", _bench_gettid);
+  interflop_set_handler("sprintf", sprintf);
+  interflop_set_handler("strcasecmp", strcasecmp);
+  interflop_set_handler("strcmp", strcmp);
+  interflop_set_handler("strerror", strerror);
+  interflop_set_handler("strtod", _bench_strtod);
+  interflop_set_handler("strtok_r", strtok_r);
+  interflop_set_handler("strtol", _bench_strtol);
+  interflop_set_handler("vfprintf", vfprintf);
+  interflop_set_handler("vwarnx", vwarnx);
+}
+
+static double _bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef void (*binary32_op_t)(float a, float b, float *res, void *context);
+typedef void (*binary64_op_t)(double a, double b, double *res, void *context);
+
+/* IEEE references, the cost of the call and of the operation alone */
+__attribute__((noinline)) static void
+_bench_add_float_ieee(float a, float b, float *res, void *context) {
+  (void)context;
+  *res = a + b;
+}
+
+__attribute__((noinline)) static void
+_bench_add_double_ieee(double a, double b, double *res, void *context) {
+  (void)context;
+  *res = a + b;
+}
+
+typedef enum {
+  bench_workload_none,
+  bench_workload_sparse,
+  bench_workload_all,
+  bench_workload_total,
+  bench_workload_subnormal,
+  _bench_workload_end_
+} bench_workload_t;
+
+static const char *BENCH_WORKLOAD_STR[] = {
+    "no-cancellation", "1%-cancellation", "100%-cancellation",
+    "total-cancellation", "subnormal-cancellation"};
+
+/* true if the operation on the i-th operands of the workload cancels */
+static bool _bench_cancels(bench_workload_t workload, int i) {
+  switch (workload) {
+  case bench_workload_sparse:
+    return i % 100 == 0;
+  case bench_workload_all:
+  case bench_workload_total:
+  case bench_workload_subnormal:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/* Start and stop of the threads of a run */
+static pthread_barrier_t bench_barrier;
+
+/* Defines the bench of binaryBITS operations:
+ *
+ * _bench_fill_TYPE fills the operand arrays such that a[i] - b[i] cancels if
+ * _bench_cancels, and does not otherwise. b is negated for additions. The
+ * cancellations are larger than 10 bits, they are above any usual tolerance.
+ * The total ones have equal operands, the subnormal ones are scaled to the
+ * smallest normal number MIN.
+ *
+ * _bench_thread_TYPE is the loop of a thread over the case operation. */
+#define define_bench(BITS, TYPE, MIN)                                          \
+  typedef struct {                                                             \
+    const char *name;                                                          \
+    binary##BITS##_op_t op;                                                    \
+    /* true if the op is an addition */                                        \
+    bool negate;                                                               \
+  } bench_case_##TYPE##_t;                                                     \
+                                                                               \
+  typedef struct {                                                             \
+    const bench_case_##TYPE##_t *bc;                                           \
+    bench_workload_t workload;                                                 \
+    void *context;                                                             \
+    unsigned long iterations;                                                  \
+    double elapsed;                                                            \
+  } bench_thread_##TYPE##_t;                                                   \
+                                                                               \
+  static void _bench_fill_##TYPE(TYPE *a, TYPE *b, bench_workload_t workload,  \
+                                 bool negate) {                                \
+    const TYPE scale = (workload == bench_workload_subnormal) ? MIN : 1;       \
+    for (int i = 0; i < BENCH_OPERANDS; i++) {                                 \
+      a[i] = (1 + (i + 1) * 0x1p-20) * scale;                                  \
+      b[i] = (workload == bench_workload_total) ? a[i]                         \
+             : _bench_cancels(workload, i)      ? scale                        \
+                                                : -0.25 * scale;               \
+      if (negate) {                                                            \
+        b[i] = -b[i];                                                          \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void *_bench_thread_##TYPE(void *arg) {                               \
+    bench_thread_##TYPE##_t *bt = (bench_thread_##TYPE##_t *)arg;              \
+    TYPE a[BENCH_OPERANDS], b[BENCH_OPERANDS];                                 \
+    _bench_fill_##TYPE(a, b, bt->workload, bt->bc->negate);                    \
+                                                                               \
+    volatile TYPE sink = 0;                                                    \
+    TYPE res;                                                                  \
+    pthread_barrier_wait(&bench_barrier);                                      \
+    const double start = _bench_now();                                         \
+    for (unsigned long i = 0; i < bt->iterations; i++) {                       \
+      const int j = i % BENCH_OPERANDS;                                        \
+      bt->bc->op(a[j], b[j], &res, bt->context);                               \
+      sink += res;                                                             \
+    }                                                                          \
+    bt->elapsed = _bench_now() - start;                                        \
+    (void)sink;                                                                \
+    return NULL;                                                               \
+  }
+
+define_bench(32, float, FLT_MIN);
+define_bench(64, double, DBL_MIN);
+
+/* Number of cancellation events in iterations operations of the workload */
+static unsigned long _bench_events(bench_workload_t workload,
+                                   unsigned long iterations) {
+  unsigned long events = 0;
+  for (int i = 0; i < BENCH_OPERANDS; i++) {
+    events += _bench_cancels(workload, i);
+  }
+  unsigned long events_tail = 0;
+  for (unsigned long i = 0; i < iterations % BENCH_OPERANDS; i++) {
+    events_tail += _bench_cancels(workload, i);
+  }
+  return events * (iterations / BENCH_OPERANDS) + events_tail;
+}
+
+/* Prints the results of a run from the elapsed times of its threads. The
+ * time per operation is the mean over the threads, the event throughput is
+ * the one of the whole run. */
+static void _bench_report(const char *name, bench_workload_t workload,
+                          int threads, unsigned long iterations,
+                          const double *elapsed) {
+  double mean = 0, wall = 0;
+  for (int i = 0; i < threads; i++) {
+    mean += elapsed[i] / threads;
+    wall = (elapsed[i] > wall) ? elapsed[i] : wall;
+  }
+  const unsigned long events = _bench_events(workload, iterations) * threads;
+  char label[64];
+  snprintf(label, sizeof(label), "%s/%s/%d", name,
+           BENCH_WORKLOAD_STR[workload], threads);
+  printf("%-44s %8.2f ns/op %10.2f Mevents/s\n", label,
+         mean * 1e9 / iterations, events / wall * 1e-6);
+}
+
+#define define_bench_run(TYPE)                                                 \
+  static void _bench_run_##TYPE(const bench_case_##TYPE##_t *bc,               \
+                                bench_workload_t workload, void *context,      \
+                                unsigned long iterations, int threads) {       \
+    pthread_t tids[threads];                                                   \
+    bench_thread_##TYPE##_t args[threads];                                     \
+    double elapsed[threads];                                                   \
+    pthread_barrier_init(&bench_barrier, NULL, threads);                       \
+    for (int i = 0; i < threads; i++) {                                        \
+      args[i] = (bench_thread_##TYPE##_t){.bc = bc,                            \
+                                          .workload = workload,                \
+                                          .context = context,                  \
+                                          .iterations = iterations};           \
+      pthread_create(&tids[i], NULL, _bench_thread_##TYPE, &args[i]);          \
+    }                                                                          \
+    for (int i = 0; i < threads; i++) {                                        \
+      pthread_join(tids[i], NULL);                                             \
+      elapsed[i] = args[i].elapsed;                                            \
+    }                                                                          \
+    pthread_barrier_destroy(&bench_barrier);                                   \
+    _bench_report(bc->name, workload, threads, iterations, elapsed);           \
+  }
+
+define_bench_run(float);
+define_bench_run(double);
+
+int main(int argc, char *argv[]) {
+  unsigned long iterations = BENCH_ITERATIONS_DEFAULT;
+  int max_threads = BENCH_THREADS_DEFAULT;
+  if (argc > 1) {
+    iterations = strtoul(argv[1], NULL, 10);
+  }
+  if (argc > 2) {
+    max_threads = atoi(argv[2]);
+  }
+
+  _bench_set_handlers();
+
+  void *context = NULL;
+  interflop_cancellation_pre_init(stderr, _bench_panic, &context);
+  cancellation_conf_t conf = {.seed = 42,
+                              .tolerance = CANCELLATION_TOLERANCE_DEFAULT,
+                              .choose_seed = true,
+                              .warning = false};
+  interflop_cancellation_configure(conf, context);
+  /* the callbacks of the interface are specialized for the configuration */
+  struct interflop_backend_interface_t interface =
+      interflop_cancellation_init(context);
+
+  const bench_case_float_t cases_float[] = {
+      {"add_float/ieee", _bench_add_float_ieee, true},
+      {"add_float", interflop_cancellation_add_float, true},
+      {"sub_float", interflop_cancellation_sub_float, false},
+      {"add_float/interface", interface.interflop_add_float, true},
+      {"sub_float/interface", interface.interflop_sub_float, false},
+  };
+  const bench_case_double_t cases_double[] = {
+      {"add_double/ieee", _bench_add_double_ieee, true},
+      {"add_double", interflop_cancellation_add_double, true},
+      {"sub_double", interflop_cancellation_sub_double, false},
+      {"add_double/interface", interface.interflop_add_double, true},
+      {"sub_double/interface", interface.interflop_sub_double, false},
+  };
+
+  /* the no-cancellation workloads measure the fast path of the check */
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    for (bench_workload_t w = 0; w < _bench_workload_end_; w++) {
+      for (size_t i = 0; i < sizeof(cases_float) / sizeof(cases_float[0]);
+           i++) {
+        _bench_run_float(&cases_float[i], w, context, iterations, threads);
+      }
+      for (size_t i = 0; i < sizeof(cases_double) / sizeof(cases_double[0]);
+           i++) {
+        _bench_run_double(&cases_double[i], w, context, iterations, threads);
+      }
+    }
+  }
+
+  return 0;
+}
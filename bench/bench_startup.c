@@ -0,0 +1,224 @@
+/*****************************************************************************\
+ *                                                                           *\
+ *  This file is part of the Verificarlo project,                            *\
+ *  under the Apache License v2.0 with LLVM Exceptions.                      *\
+ *  SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception.                 *\
+ *  See https://llvm.org/LICENSE.txt for license information.                *\
+ *                                                                           *\
+ *  Copyright (c) 2019-2022                                                  *\
+ *     Verificarlo Contributors                                              *\
+ *                                                                           *\
+ ****************************************************************************/
+// Startup benchmark of the cancellation backend.
+//
+// Instrumented processes pay the pre_init, configure and init of the backend
+// once, and its finalize at exit, which matters for runs of many short
+// processes. Each measure is taken in a fresh child process, so that the
+// backend starts from its initial state as in a real program: the children
+// time the calls with the default configuration and send the times to the
+// parent, which reports their minimum, median and mean. The runs are made
+// with the loading message, then without it, with VFC_BACKENDS_SILENT_LOAD.
+// The process creation and the loading of the library are not counted.
+//
+// Usage: bench_startup [processes]
+
+#include <err.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "interflop-stdlib/interflop.h"
+#include "interflop-stdlib/interflop_stdlib.h"
+#include "interflop_cancellation.h"
+
+#define BENCH_PROCESSES_DEFAULT 1000
+
+/* stdlib handlers required by the backend */
+static File *_bench_fopen(const char *path, const char *mode, int *error) {
+  FILE *f = fopen(path, mode);
+  *error = (f == NULL) ? errno : 0;
+  return f;
+}
+
+static void _bench_panic(const char *msg) {
+  fprintf(stderr, "%s", msg);
+  exit(1);
+}
+
+static long _bench_strtol(const char *nptr, char **endptr, int *error) {
+  errno = 0;
+  long val = strtol(nptr, endptr, 10);
+  *error = errno;
+  return val;
+}
+
+static double _bench_strtod(const char *nptr, char **endptr, int *error) {
+  errno = 0;
+  double val = strtod(nptr, endptr);
+  *error = errno;
+  return val;
+}
+
+static int _bench_fclose(File *stream, int *error) {
+  const int ret = fclose((FILE *)stream);
+  *error = (ret != 0) ? errno : 0;
+  return ret;
+}
+
+static char *_bench_fgets(char *s, int size, File *stream) {
+  return fgets(s, size, (FILE *)stream);
+}
+
+static int _bench_gettid(void) { return syscall(SYS_gettid); }
+
+static void _bench_set_handlers(void) {
+  interflop_set_handler("malloc", malloc);
+  interflop_set_handler("exit", exit);
+  interflop_set_handler("fclose", _bench_fclose);
+  interflop_set_handler("fgets", _bench_fgets);
+  interflop_set_handler("fopen", _bench_fopen);
+  interflop_set_handler("panic", _bench_panic);
+  interflop_set_handler("fprintf", fprintf);
+  interflop_set_handler("getenv", getenv);
+  interflop_set_handler("gettid", _bench_gettid);
+  interflop_set_handler("sprintf", sprintf);
+  interflop_set_handler("strcasecmp", strcasecmp);
+  interflop_set_handler("strcmp", strcmp);
+  interflop_set_handler("strerror", strerror);
+  interflop_set_handler("strtod", _bench_strtod);
+  interflop_set_handler("strtok_r", strtok_r);
+  interflop_set_handler("strtol", _bench_strtol);
+  interflop_set_handler("vfprintf", vfprintf);
+  interflop_set_handler("vwarnx", vwarnx);
+}
+
+static double _bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Phases timed in each process */
+typedef enum {
+  bench_phase_pre_init,
+  bench_phase_init,
+  bench_phase_finalize,
+  bench_phase_total,
+  _bench_phase_end_
+} bench_phase_t;
+
+static const char *BENCH_PHASE_STR[] = {"pre_init", "configure+init",
+                                        "finalize", "total"};
+
+/* Starts the backend as verificarlo does, and writes the time of each phase
+ * to fd. The log lines of the backend go to log */
+static void _bench_child(int fd, FILE *log) {
+  double elapsed[_bench_phase_end_];
+  void *context = NULL;
+  const double start = _bench_now();
+  interflop_cancellation_pre_init(log, _bench_panic, &context);
+  const double pre_init = _bench_now();
+  cancellation_conf_t conf = {.tolerance = CANCELLATION_TOLERANCE_DEFAULT,
+                              .warning = false};
+  interflop_cancellation_configure(conf, context);
+  struct interflop_backend_interface_t interface =
+      interflop_cancellation_init(context);
+  const double init = _bench_now();
+  interface.interflop_finalize(context);
+  const double finalize = _bench_now();
+  elapsed[bench_phase_pre_init] = pre_init - start;
+  elapsed[bench_phase_init] = init - pre_init;
+  elapsed[bench_phase_finalize] = finalize - init;
+  elapsed[bench_phase_total] = finalize - start;
+  if (write(fd, elapsed, sizeof(elapsed)) != sizeof(elapsed)) {
+    _exit(1);
+  }
+  _exit(0);
+}
+
+static int _bench_compare(const void *x, const void *y) {
+  const double a = *(const double *)x, b = *(const double *)y;
+  return (a > b) - (a < b);
+}
+
+static void _bench_report(const char *name, double *times, int n) {
+  qsort(times, n, sizeof(double), _bench_compare);
+  double mean = 0;
+  for (int i = 0; i < n; i++) {
+    mean += times[i] / n;
+  }
+  printf("%-24s %10.2f us min %10.2f us median %10.2f us mean\n", name,
+         times[0] * 1e6, times[n / 2] * 1e6, mean * 1e6);
+}
+
+/* Times the startup of processes processes, silent selects
+ * VFC_BACKENDS_SILENT_LOAD */
+static void _bench_run(int processes, bool silent, FILE *log) {
+  double *times[_bench_phase_end_];
+  for (int p = 0; p < _bench_phase_end_; p++) {
+    times[p] = malloc(processes * sizeof(double));
+  }
+  for (int i = 0; i < processes; i++) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+      err(1, "cannot create a pipe");
+    }
+    const pid_t pid = fork();
+    if (pid < 0) {
+      err(1, "cannot fork");
+    }
+    if (pid == 0) {
+      close(fds[0]);
+      if (silent) {
+        setenv("VFC_BACKENDS_SILENT_LOAD", "True", 1);
+      }
+      _bench_child(fds[1], log);
+    }
+    close(fds[1]);
+    double elapsed[_bench_phase_end_];
+    const ssize_t n = read(fds[0], elapsed, sizeof(elapsed));
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (n != sizeof(elapsed) || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      errx(1, "process %d failed", i);
+    }
+    for (int p = 0; p < _bench_phase_end_; p++) {
+      times[p][i] = elapsed[p];
+    }
+  }
+
+  printf("startup of %d processes%s\n", processes,
+         silent ? ", VFC_BACKENDS_SILENT_LOAD=True" : "");
+  for (int p = 0; p < _bench_phase_end_; p++) {
+    _bench_report(BENCH_PHASE_STR[p], times[p], processes);
+    free(times[p]);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int processes = BENCH_PROCESSES_DEFAULT;
+  if (argc > 1) {
+    processes = atoi(argv[1]);
+  }
+  if (processes < 1) {
+    errx(1, "usage: %s [processes]", argv[0]);
+  }
+
+  _bench_set_handlers();
+  FILE *log = fopen("/dev/null", "w");
+  if (log == NULL) {
+    err(1, "cannot open /dev/null");
+  }
+  _bench_run(processes, false, log);
+  _bench_run(processes, true, log);
+  return 0;
+}
@@ -27,13 +27,18 @@
 
 #include <argp.h>
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/mman.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "interflop-stdlib/common/float_const.h"
@@ -46,8 +51,15 @@
 #include "interflop-stdlib/iostream/logger.h"
 #include "interflop-stdlib/rng/vfc_rng.h"
 #include "interflop_cancellation.h"
+#include "interflop_cancellation_stats.h"
+#include "interflop_cancellation_trace.h"
 
-/* Disable thread safety for RNG required for Valgrind */
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/* Disable thread-local storage, which is not available to Valgrind tools.
+ * The per-thread state is then always looked up with a thread-specific key */
 #ifdef RNG_THREAD_SAFE
 #define TLS __thread
 #else
@@ -55,10 +67,88 @@
 #endif
 
 #define max(a, b) ((a) > (b) ? (a) : (b))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+#define CHECK_IMPL(name)                                                       \
+  if (interflop_##name == Null) {                                              \
+    interflop_panic("Interflop backend error: " #name " not implemented\n");   \
+  }
+
+void _cancellation_check_stdlib(void) {
+  CHECK_IMPL(malloc);
+  CHECK_IMPL(exit);
+  CHECK_IMPL(fopen);
+  CHECK_IMPL(fprintf);
+  CHECK_IMPL(getenv);
+  CHECK_IMPL(gettid);
+  CHECK_IMPL(sprintf);
+  CHECK_IMPL(strcasecmp);
+  CHECK_IMPL(strerror);
+  CHECK_IMPL(strtol);
+  CHECK_IMPL(vfprintf);
+  CHECK_IMPL(vwarnx);
+}
+
+/* Checks the handlers only used by some options, so that the hosts without
+ * them can still load the backend */
+static void _cancellation_check_stdlib_options(
+    const cancellation_context_t *ctx) {
+  if (ctx->tolerance_file != NULL) {
+    CHECK_IMPL(fgets);
+    CHECK_IMPL(strtok_r);
+  }
+  if (ctx->tolerance_file != NULL || ctx->histogram_file != NULL ||
+      ctx->trace_file != NULL) {
+    CHECK_IMPL(fclose);
+  }
+  if (ctx->tolerance_file != NULL || ctx->mpi_reduce) {
+    CHECK_IMPL(strcmp);
+  }
+}
+
+/* The stdlib handlers are checked before their first use rather than at
+ * pre_init: by the parsing of the options, by init or by the first message.
+ * The checks only read the handlers, two threads can run them at once */
+static bool stdlib_is_checked = false;
+
+static void _stdlib_once(void) {
+  if (!__atomic_load_n(&stdlib_is_checked, __ATOMIC_ACQUIRE)) {
+    _cancellation_check_stdlib();
+    __atomic_store_n(&stdlib_is_checked, true, __ATOMIC_RELEASE);
+  }
+}
+
+/* The logger is set up on its first message rather than at pre_init, so that
+ * the processes that log nothing never pay for it. logger_init only records
+ * the stream and reads the environment, it can be called again by two
+ * threads logging their first message at once */
+static File *logger_stream = NULL;
+static bool logger_is_init = false;
+
+static void _logger_once(void) {
+  if (!__atomic_load_n(&logger_is_init, __ATOMIC_ACQUIRE)) {
+    _stdlib_once();
+    logger_init(logger_stream);
+    __atomic_store_n(&logger_is_init, true, __ATOMIC_RELEASE);
+  }
+}
 
+#define logger_info(...) (_logger_once(), logger_info(__VA_ARGS__))
+#define logger_warning(...) (_logger_once(), logger_warning(__VA_ARGS__))
+#define logger_error(...) (_logger_once(), logger_error(__VA_ARGS__))
+
+/* The tolerance can be changed by a user call while other threads check
+ * operations, it is stored and read with relaxed atomic accesses, see
+ * _context_tolerance */
 static void _set_cancellation_tolerance(int tolerance, void *context) {
   cancellation_context_t *ctx = (cancellation_context_t *)context;
-  ctx->tolerance = tolerance;
+  __atomic_store_n(&ctx->tolerance, tolerance, __ATOMIC_RELAXED);
+}
+
+static void _set_cancellation_tolerance_file(const char *file,
+                                             void *context) {
+  cancellation_context_t *ctx = (cancellation_context_t *)context;
+  ctx->tolerance_file = file;
 }
 
 static void _set_cancellation_warning(bool warning, void *context) {
@@ -66,6 +156,103 @@ static void _set_cancellation_warning(bool warning, void *context) {
   ctx->warning = warning;
 }
 
+static void _set_cancellation_warning_mode(cancellation_warning_mode_t mode,
+                                          void *context) {
+  cancellation_context_t *ctx = (cancellation_context_t *)context;
+  ctx->warning_mode = mode;
+}
+
+static void _set_cancellation_warning_sample_rate(int rate, void *context) {
+  cancellation_context_t *ctx = (cancellation_context_t *)context;
+  /* an unset rate falls back to reporting every event */
+  ctx->warning_sample_rate = (rate < 1) ? 1 : rate;
+}
+
+static void _set_cancellation_warning_max_lines(uint64_t max_lines,
+                                               void *context) {
+  cancellation_context_t *ctx = (cancellation_context_t *)context;
+  ctx->warning_max_lines = max_lines;
+}
+
+static void _set_cancellation_warning_period(uint64_t period, void *context) {
+  cancellation_context_t *ctx = (cancellation_context_t *)context;
+  ctx->warning_period = period;
+}
+
+static void _set_cancellation_histogram_file(const char *file, void *context) {
+  cancellation_context_t *ctx = (cancellation_context_t *)context;
+  ctx->histogram_file = file;
+}
+
+static void _set_cancellation_trace_file(const char *file, void *context) {
+  cancellation_context_t *ctx = (cancellation_context_t *)context;
+  ctx->trace_file = file;
+}
+
+static void
+_set_cancellation_histogram_format(cancellation_histogram_format_t format,
+                                   void *context) {
+  cancellation_context_t *ctx = (cancellation_context_t *)context;
+  ctx->histogram_format = format;
+}
+
+static void _set_cancellation_top_functions(int top_functions,
+                                            void *context) {
+  cancellation_context_t *ctx = (cancellation_context_t *)context;
+  ctx->top_functions = top_functions;
+}
+
+static void _set_cancellation_mpi_reduce(bool mpi_reduce, void *context) {
+  cancellation_context_t *ctx = (cancellation_context_t *)context;
+  ctx->mpi_reduce = mpi_reduce;
+}
+
+static void _set_cancellation_precision_loss(bool precision_loss,
+                                            void *context) {
+  cancellation_context_t *ctx = (cancellation_context_t *)context;
+  ctx->precision_loss = precision_loss;
+}
+
+static void _set_cancellation_sample_period(uint64_t period, void *context) {
+  cancellation_context_t *ctx = (cancellation_context_t *)context;
+  /* an unset period falls back to checking every operation */
+  ctx->sample_period = (period < 1) ? 1 : period;
+}
+
+static void _set_cancellation_sample_rate(double rate, void *context) {
+  cancellation_context_t *ctx = (cancellation_context_t *)context;
+  ctx->sample_rate = (rate <= 0 || rate > 1) ? 1 : rate;
+}
+
+static void _set_cancellation_mode(cancellation_mode_t mode, void *context) {
+  cancellation_context_t *ctx = (cancellation_context_t *)context;
+  ctx->mode = mode;
+}
+
+static void _set_cancellation_noise(cancellation_noise_t noise,
+                                    void *context) {
+  cancellation_context_t *ctx = (cancellation_context_t *)context;
+  ctx->noise = noise;
+}
+
+static void _set_cancellation_samples(int samples, void *context) {
+  cancellation_context_t *ctx = (cancellation_context_t *)context;
+  /* an unset number falls back to a single sample */
+  ctx->samples = (samples < 1) ? 1 : samples;
+}
+
+static void _set_cancellation_stats(bool stats, void *context) {
+  cancellation_context_t *ctx = (cancellation_context_t *)context;
+  ctx->stats = stats;
+}
+
+static void
+_set_cancellation_thread_storage(cancellation_thread_storage_t thread_storage,
+                                 void *context) {
+  cancellation_context_t *ctx = (cancellation_context_t *)context;
+  ctx->thread_storage = thread_storage;
+}
+
 static void _set_cancellation_seed(uint64_t seed, cancellation_context_t *ctx) {
   ctx->seed = seed;
   ctx->choose_seed = true;
@@ -79,71 +266,2853 @@ const char *INTERFLOP_CANCELLATION_API(get_backend_version)(void) {
   return "1.x-dev";
 }
 
-/* global thread identifier */
-static pid_t global_tid = 0;
+/* Number of interleaved xoshiro256+ streams */
+#define RNG_LANES 4
+/* Number of random numbers in the ring, must be a multiple of RNG_LANES */
+#define RNG_RING_SIZE 256
+
+typedef struct {
+  /* xoshiro256+ states, s[i][lane] is the word i of the stream lane */
+  uint64_t s[4][RNG_LANES];
+  /* random numbers in [-0.5, 0.5), one per 64-bit output */
+  double values[RNG_RING_SIZE];
+  /* random binary32 numbers in [-0.5, 0.5), two per 64-bit output */
+  float values_binary32[2 * RNG_RING_SIZE];
+  /* random bits, one per noise of --noise=sign */
+  uint64_t signs[RNG_LANES];
+  /* number of values and of bits not consumed yet */
+  uint32_t remaining;
+  uint32_t remaining_binary32;
+  uint32_t remaining_signs;
+  bool is_init;
+} rng_ring_t;
+
+/* cancellations attributed to a function, see the function tables below */
+struct function_entry;
+
+/* Per-thread state of the backend. Everything a thread writes on its own
+ * lives in its block, aligned and padded to cache lines so that the blocks
+ * of two threads never share one. The fields read on every operation come
+ * first, the RNG ring ends the block */
+typedef struct thread_state {
+  /* true while the checking is stopped on the thread by a user call */
+  bool checking_disabled;
+  /* true once rng_state has been seeded for the thread */
+  bool rng_state_is_init;
+  /* true between cancellation_push_seed and cancellation_pop_seed */
+  bool rng_state_is_pushed;
+  /* true once thread_index is assigned, see _rng_ring_seed_value */
+  bool thread_index_is_set;
+  /* thread identifier given to the RNG of interflop-stdlib, which reseeds
+   * rng_state when it does not match the calling thread */
+  pid_t tid;
+  /* index of the thread, which selects its noise stream with --seed */
+  uint32_t thread_index;
+  /* operations left before the next sampled one */
+  uint64_t sample_countdown;
+  /* recording buffers, allocated on the first cancellation of the thread */
+  struct report_buffer *report_buffer;
+  struct histogram *histogram;
+  struct function_table *function_table;
+  struct precision_loss *precision_loss;
+  struct spread *spread;
+  struct underflow *underflow;
+#ifdef SELF_PROFILING
+  struct profile *profile;
+#endif
+  /* entry of the function currently executed by the thread, NULL outside of
+   * instrumented functions */
+  struct function_entry *function_entry;
+  /* tolerance of the file for that function, see _function_enter */
+  int32_t function_tolerance;
+  /* next free record of the trace chunk of the thread, and its end */
+  cancellation_trace_record_t *trace_cursor;
+  cancellation_trace_record_t *trace_end;
+  /* thread identifier written in the trace records */
+  uint32_t trace_tid;
+  /* slot of the thread in the live counters, claimed on its first
+   * operation */
+  cancellation_stats_thread_t *stats;
+  /* next state on the free list, once its thread has exited */
+  struct thread_state *next;
+  /* helper data structure to centralize the data used for random number
+   * generation */
+  rng_state_t rng_state;
+  /* copy saved by cancellation_push_seed */
+  rng_state_t rng_state_saved;
+  rng_ring_t rng_ring __attribute__((aligned(64)));
+} __attribute__((aligned(64))) thread_state_t;
+
+#ifdef RNG_THREAD_SAFE
+static TLS thread_state_t thread_state;
+#endif
+
+/* Arena of the backend bookkeeping: the contexts, the per-thread states and
+ * buffers, the function tables and the tables built at init and finalize are
+ * carved from chunks mapped with mmap, and never freed. The first chunk is
+ * mapped by pre_init and the arena grows by whole chunks, so the operations
+ * never call malloc, which is intercepted and slow under Valgrind tools.
+ * Allocations are aligned on cache lines, and a chunk is lock-free: a thread
+ * bumps its offset with an atomic add, and the thread that overflows it maps
+ * the next one */
+
+/* Size of the chunks, the pages are only committed once touched */
+#define ARENA_CHUNK_SIZE (4UL << 20)
+#define ARENA_ALIGN 64
+
+typedef struct arena_chunk {
+  /* bytes handed out from the start of the chunk, header included; may
+   * exceed size once the chunk is exhausted */
+  uint64_t used;
+  uint64_t size;
+  struct arena_chunk *previous;
+} __attribute__((aligned(ARENA_ALIGN))) arena_chunk_t;
+
+/* chunk being carved */
+static arena_chunk_t *arena = NULL;
+
+/* Maps a chunk large enough for size bytes and installs it in place of
+ * current, unless another thread already did */
+static __attribute__((noinline)) void _arena_grow(arena_chunk_t *current,
+                                                  const uint64_t size) {
+  /* rounded up to whole chunks for the allocations larger than a chunk */
+  const uint64_t chunk_size =
+      (sizeof(arena_chunk_t) + size + ARENA_CHUNK_SIZE - 1) &
+      ~(ARENA_CHUNK_SIZE - 1);
+  void *p = mmap(NULL, chunk_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED) {
+    logger_error("interflop_cancellation: cannot map %lu bytes: %s\n",
+                 chunk_size, interflop_strerror(errno));
+  }
+  arena_chunk_t *chunk = (arena_chunk_t *)p;
+  *chunk = (arena_chunk_t){sizeof(arena_chunk_t), chunk_size, current};
+  if (!__atomic_compare_exchange_n(&arena, &current, chunk, false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    munmap(p, chunk_size);
+  }
+}
+
+/* Returns size bytes of zeroed memory, aligned on ARENA_ALIGN */
+static void *_arena_alloc(uint64_t size) {
+  size = (size + ARENA_ALIGN - 1) & ~(uint64_t)(ARENA_ALIGN - 1);
+  for (;;) {
+    arena_chunk_t *chunk = __atomic_load_n(&arena, __ATOMIC_ACQUIRE);
+    if (chunk != NULL) {
+      const uint64_t offset =
+          __atomic_fetch_add(&chunk->used, size, __ATOMIC_RELAXED);
+      if (offset + size <= chunk->size) {
+        return (char *)chunk + offset;
+      }
+    }
+    _arena_grow(chunk, size);
+  }
+}
+
+/* Without TLS, or when selected with --thread-storage=table, the per-thread
+ * states are allocated on demand and found with a POSIX thread-specific key,
+ * which needs neither the thread identifier nor TLS. When a thread exits, the
+ * destructor of the key releases its state on a free list: the next thread
+ * reuses it zeroed, so a recycled tid never inherits the RNG, the flags or
+ * the buffers of a dead thread. The buffers stay on the lists of finalize */
+
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+/* states of the exited threads, guarded by thread_free_lock */
+static thread_state_t *thread_free_states = NULL;
+static pthread_mutex_t thread_free_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef RNG_THREAD_SAFE
+/* true if the per-thread states are looked up with thread_key, set at init */
+static bool thread_storage_table = false;
+#endif
+
+static void _trace_close_chunk(thread_state_t *state);
+
+/* Destructor of thread_key, called at the exit of a thread that has a state */
+static void _thread_state_release(void *p) {
+  thread_state_t *state = (thread_state_t *)p;
+  _trace_close_chunk(state);
+  pthread_mutex_lock(&thread_free_lock);
+  state->next = thread_free_states;
+  thread_free_states = state;
+  pthread_mutex_unlock(&thread_free_lock);
+}
+
+static void _thread_key_create(void) {
+  if (pthread_key_create(&thread_key, _thread_state_release) != 0) {
+    logger_error("interflop_cancellation: cannot create the key of the "
+                 "per-thread states\n");
+  }
+}
+
+/* Gives the calling thread a zeroed state, recycled if one is free */
+static __attribute__((noinline)) thread_state_t *_thread_state_new(void) {
+  pthread_mutex_lock(&thread_free_lock);
+  thread_state_t *state = thread_free_states;
+  if (state != NULL) {
+    thread_free_states = state->next;
+  }
+  pthread_mutex_unlock(&thread_free_lock);
+  if (state == NULL) {
+    state = (thread_state_t *)_arena_alloc(sizeof(thread_state_t));
+  }
+  *state = (thread_state_t){0};
+  pthread_setspecific(thread_key, state);
+  return state;
+}
+
+/* Returns the state of the calling thread. Callers that need it several
+ * times look it up once and pass it along */
+static inline thread_state_t *_get_thread_state(void) {
+#ifdef RNG_THREAD_SAFE
+  if (__builtin_expect(!thread_storage_table, 1)) {
+    return &thread_state;
+  }
+#endif
+  thread_state_t *state = (thread_state_t *)pthread_getspecific(thread_key);
+  return __builtin_expect(state != NULL, 1) ? state : _thread_state_new();
+}
+
+/* Pushes NODE on the lock-free list starting at HEAD. Per-thread buffers are
+ * registered this way so that finalize can walk the buffers of all threads */
+#define list_push(HEAD, NODE)                                                  \
+  {                                                                            \
+    (NODE)->next = __atomic_load_n(HEAD, __ATOMIC_RELAXED);                    \
+    while (!__atomic_compare_exchange_n(HEAD, &(NODE)->next, NODE, true,       \
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))   \
+      ;                                                                        \
+  }
+
+/* Self-profiling, in builds configured with --enable-self-profiling: the
+ * callbacks of the interface are wrapped at init to count their calls per
+ * thread, the ones that reach the slow path of the check and the ones that
+ * perturb their result, and to time one call out of PROFILE_SAMPLE_PERIOD on
+ * average with the cycle counter. The random numbers drawn and the refills of
+ * the rings are counted too. The breakdown is reported at finalize. Other
+ * builds only keep empty hooks */
+
+/* Callbacks profiled, in the order of the interface */
+typedef enum {
+  profile_add_float,
+  profile_sub_float,
+  profile_mul_float,
+  profile_div_float,
+  profile_add_double,
+  profile_sub_double,
+  profile_mul_double,
+  profile_div_double,
+  profile_fma_float,
+  profile_fma_double,
+  _profile_callback_end_
+} profile_callback_t;
+
+#ifdef SELF_PROFILING
+
+static const char *PROFILE_CALLBACK_STR[] = {
+    "add_float",  "sub_float",  "mul_float",  "div_float", "add_double",
+    "sub_double", "mul_double", "div_double", "fma_float", "fma_double"};
+
+/* mean number of calls between two timed calls of a thread, a power of two.
+ * The intervals are drawn in [1, 2 * PROFILE_SAMPLE_PERIOD) so that the
+ * timed calls are not aligned on the refills of the 256-value rings */
+#define PROFILE_SAMPLE_PERIOD 256
+
+#if defined(__x86_64__)
+#define PROFILE_UNIT "cycles"
+static inline uint64_t _profile_clock(void) { return __rdtsc(); }
+#else
+#define PROFILE_UNIT "ns"
+static inline uint64_t _profile_clock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+/* counters of a thread, only written by their thread, see _stats_add */
+typedef struct profile {
+  uint64_t calls[_profile_callback_end_];
+  uint64_t slow[_profile_callback_end_];
+  uint64_t perturbed[_profile_callback_end_];
+  /* time of the sampled calls, and their number */
+  uint64_t clock[_profile_callback_end_];
+  uint64_t sampled[_profile_callback_end_];
+  /* totals of the thread, compared around a call to attribute its slow path
+   * and its noises */
+  uint64_t slow_total;
+  uint64_t noises_total;
+  uint64_t draws;
+  uint64_t refills;
+  /* calls left before the next timed one, and the xorshift state that
+   * draws the intervals */
+  uint64_t countdown;
+  uint64_t interval_state;
+  struct profile *next;
+} profile_t;
+
+/* list of the counters of all threads, reduced at finalize */
+static profile_t *profiles = NULL;
+
+/* cost of reading the clock twice, subtracted from the sampled times */
+static uint64_t profile_clock_overhead = 0;
+
+static inline void _profile_add(uint64_t *count, const uint64_t n) {
+  __atomic_store_n(count, __atomic_load_n(count, __ATOMIC_RELAXED) + n,
+                   __ATOMIC_RELAXED);
+}
+
+static __attribute__((noinline)) profile_t *_new_profile(void) {
+  profile_t *p = (profile_t *)_arena_alloc(sizeof(profile_t));
+  *p = (profile_t){.countdown = PROFILE_SAMPLE_PERIOD,
+                   .interval_state = (uintptr_t)p | 1};
+  list_push(&profiles, p);
+  return p;
+}
+
+static inline profile_t *_get_profile(void) {
+  thread_state_t *state = _get_thread_state();
+  if (__builtin_expect(state->profile == NULL, 0)) {
+    state->profile = _new_profile();
+  }
+  return state->profile;
+}
+
+static inline void _profile_slow(void) {
+  _profile_add(&_get_profile()->slow_total, 1);
+}
+
+static inline void _profile_noises(const uint64_t n) {
+  _profile_add(&_get_profile()->noises_total, n);
+}
+
+static inline void _profile_draws(const uint64_t n) {
+  _profile_add(&_get_profile()->draws, n);
+}
+
+static inline void _profile_refill(void) {
+  _profile_add(&_get_profile()->refills, 1);
+}
+
+static uint64_t _profile_interval(profile_t *p) {
+  uint64_t x = p->interval_state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  p->interval_state = x;
+  return 1 + (x & (2 * PROFILE_SAMPLE_PERIOD - 2));
+}
+
+/* Runs CALL as the callback CALLBACK of the interface */
+#define profile_call(CALLBACK, CALL)                                           \
+  {                                                                            \
+    profile_t *p = _get_profile();                                             \
+    const uint64_t slow = p->slow_total;                                       \
+    const uint64_t noises = p->noises_total;                                   \
+    _profile_add(&p->calls[CALLBACK], 1);                                      \
+    if (__builtin_expect(--p->countdown == 0, 0)) {                            \
+      p->countdown = _profile_interval(p);                                     \
+      const uint64_t start = _profile_clock();                                 \
+      CALL;                                                                    \
+      const uint64_t elapsed = _profile_clock() - start;                       \
+      _profile_add(&p->clock[CALLBACK], elapsed);                              \
+      _profile_add(&p->sampled[CALLBACK], 1);                                  \
+    } else {                                                                   \
+      CALL;                                                                    \
+    }                                                                          \
+    _profile_add(&p->slow[CALLBACK], p->slow_total != slow);                   \
+    _profile_add(&p->perturbed[CALLBACK], p->noises_total != noises);          \
+  }
+
+/* Measures the overhead of the clock, the smallest of a few readings */
+static void _profile_init(void) {
+  uint64_t overhead = UINT64_MAX;
+  for (int i = 0; i < 64; i++) {
+    const uint64_t start = _profile_clock();
+    const uint64_t elapsed = _profile_clock() - start;
+    overhead = (elapsed < overhead) ? elapsed : overhead;
+  }
+  profile_clock_overhead = overhead;
+}
+
+static void _profile_report(const char *callbacks) {
+  profile_t total = {0};
+  int threads = 0;
+  const profile_t *p = __atomic_load_n(&profiles, __ATOMIC_ACQUIRE);
+  for (; p != NULL; p = p->next, threads++) {
+    for (int i = 0; i < _profile_callback_end_; i++) {
+      total.calls[i] += __atomic_load_n(&p->calls[i], __ATOMIC_RELAXED);
+      total.slow[i] += __atomic_load_n(&p->slow[i], __ATOMIC_RELAXED);
+      total.perturbed[i] +=
+          __atomic_load_n(&p->perturbed[i], __ATOMIC_RELAXED);
+      total.clock[i] += __atomic_load_n(&p->clock[i], __ATOMIC_RELAXED);
+      total.sampled[i] += __atomic_load_n(&p->sampled[i], __ATOMIC_RELAXED);
+    }
+    total.draws += __atomic_load_n(&p->draws, __ATOMIC_RELAXED);
+    total.refills += __atomic_load_n(&p->refills, __ATOMIC_RELAXED);
+  }
+  logger_info("interflop_cancellation: self-profile of %d threads, %s "
+              "callbacks, %s per call sampled 1/%d, less %lu for the clock\n",
+              threads, callbacks, PROFILE_UNIT,
+              PROFILE_SAMPLE_PERIOD, profile_clock_overhead);
+  logger_info("  %-12s %14s %14s %14s %10s\n", "callback", "calls",
+              "slow path", "perturbed", PROFILE_UNIT);
+  for (int i = 0; i < _profile_callback_end_; i++) {
+    if (total.calls[i] == 0) {
+      continue;
+    }
+    double per_call = 0;
+    if (total.sampled[i] != 0) {
+      per_call = (double)total.clock[i] / total.sampled[i] -
+                 (double)profile_clock_overhead;
+    }
+    logger_info("  %-12s %14lu %14lu %14lu %10.1f\n", PROFILE_CALLBACK_STR[i],
+                total.calls[i], total.slow[i], total.perturbed[i],
+                (per_call > 0) ? per_call : 0);
+  }
+  logger_info("  random numbers drawn: %lu, ring refills: %lu\n", total.draws,
+              total.refills);
+}
+
+#else
+
+static inline void _profile_slow(void) {}
+static inline void _profile_noises(const uint64_t n) { (void)n; }
+static inline void _profile_draws(const uint64_t n) { (void)n; }
+static inline void _profile_refill(void) {}
 
-/* helper data structure to centralize the data used for random number
- * generation */
-static TLS rng_state_t rng_state;
-/* copy */
-static TLS rng_state_t __rng_state;
+#endif /* SELF_PROFILING */
 
 /* Function used by Verrou to save the */
 /* current rng state and replace it by the new seed */
 void cancellation_push_seed(uint64_t seed) {
-  __rng_state = rng_state;
-  _init_rng_state_struct(&rng_state, true, seed, false);
+  thread_state_t *state = _get_thread_state();
+  state->rng_state_saved = state->rng_state;
+  _init_rng_state_struct(&state->rng_state, true, seed, false);
+  state->rng_state_is_init = true;
+  state->rng_state_is_pushed = true;
 }
 
 /* Function used by Verrou to restore the copied rng state */
-void cancellation_pop_seed() { rng_state = __rng_state; }
+void cancellation_pop_seed() {
+  thread_state_t *state = _get_thread_state();
+  state->rng_state = state->rng_state_saved;
+  state->rng_state_is_pushed = false;
+}
 
-/* noise = rand * 2^(exp) */
-static inline double _noise_binary64(const int exp, rng_state_t *rng_state) {
-  const double d_rand = get_rand_double01(rng_state, &global_tid) - 0.5;
-  binary64 b64 = {.f64 = d_rand};
-  b64.ieee.exponent += exp;
-  return b64.f64;
+/* Returns the RNG state of the calling thread. The state is seeded only once
+ * per thread, on the first cancellation, with the seed of the context */
+static inline rng_state_t *_get_rng_state(thread_state_t *state,
+                                          const cancellation_context_t *ctx) {
+  if (__builtin_expect(!state->rng_state_is_init, 0)) {
+    _init_rng_state_struct(&state->rng_state, ctx->choose_seed,
+                           (unsigned long long int)(ctx->seed), false);
+    state->rng_state_is_init = true;
+  }
+  return &state->rng_state;
 }
 
-/* cancell: detects the cancellation size; and checks if its larger than the
- * chosen tolerance. It reports a warning to the user and adds a MCA noise of
- * the magnitude of the cancelled bits. */
-#define cancell(X, Y, Z, CTX, RNG_STATE)                                       \
-  {                                                                            \
-    cancellation_context_t *TMP_CTX = (cancellation_context_t *)CTX;           \
-    const int32_t e_z = GET_EXP_FLT(*Z);                                       \
-    /* computes the difference between the max of both operands and the        \
-     * exponent of the result to find the size of the cancellation */          \
-    int cancellation = max(GET_EXP_FLT(X), GET_EXP_FLT(Y)) - e_z;              \
-    if (cancellation >= TMP_CTX->tolerance) {                                  \
-      if (TMP_CTX->warning) {                                                  \
-        logger_info("cancellation of size %d detected\n", cancellation);       \
-      }                                                                        \
-      /* Add an MCA noise of the magnitude of cancelled bits.                  \
-       * This particular version in the case of cancellations does not use     \
-       * extended quad types */                                                \
-      const int32_t e_n = e_z - (cancellation - 1);                            \
-      _init_rng_state_struct(&RNG_STATE, TMP_CTX->choose_seed, TMP_CTX->seed,  \
-                             false);                                           \
-      *Z += _noise_binary64(e_n, &RNG_STATE);                                  \
+/* The random numbers of the noises are taken from a per-thread ring, refilled
+ * by blocks with a xoshiro256+ generator running RNG_LANES interleaved
+ * streams. The refill loop has no dependency between lanes and is
+ * vectorized. With --seed, the generator of a thread is seeded by hashing
+ * the seed with the index of the thread, so that the noises of each thread
+ * are reproduced whatever the scheduling of the threads; otherwise it is
+ * seeded from rng_state. While a seed is pushed by Verrou, the numbers are
+ * drawn from rng_state to only depend on the pushed seed */
+
+static inline uint64_t _rng_rotl(const uint64_t x, const int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+/* output function of splitmix64, a bijection of the 64-bit integers */
+static inline uint64_t _rng_mix64(uint64_t z) {
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+/* splitmix64, the recommended generator to seed xoshiro states */
+static inline uint64_t _splitmix64(uint64_t *x) {
+  return _rng_mix64(*x += 0x9E3779B97F4A7C15ULL);
+}
+
+/* OpenMP runtime, resolved if the program links one */
+extern int omp_in_parallel(void) __attribute__((weak));
+extern int omp_get_level(void) __attribute__((weak));
+extern int omp_get_ancestor_thread_num(int level) __attribute__((weak));
+extern int omp_get_team_size(int level) __attribute__((weak));
+
+/* next thread index given outside of OpenMP */
+static uint32_t thread_index_next = 0;
+/* bit of the indices given outside of the parallel regions of an OpenMP
+ * program, kept apart from the OpenMP ones */
+#define THREAD_INDEX_OUTSIDE_OPENMP (1U << 31)
+
+/* Returns the index of the calling thread. In a parallel region, it is its
+ * position in the nested teams: the thread number within a single level of
+ * parallelism. Otherwise it is the order in which the threads seed their
+ * generators, which is only reproducible when the threads draw their first
+ * noises in a fixed order: programs that start their own threads set the
+ * indices with cancellation_set_thread_index */
+static uint32_t _thread_index(void) {
+  if (omp_in_parallel != NULL && omp_in_parallel()) {
+    uint32_t index = 0;
+    for (int level = 1; level <= omp_get_level(); level++) {
+      index = index * (uint32_t)omp_get_team_size(level) +
+              (uint32_t)omp_get_ancestor_thread_num(level);
+    }
+    return index;
+  }
+  const uint32_t index =
+      __atomic_fetch_add(&thread_index_next, 1, __ATOMIC_RELAXED);
+  return (omp_in_parallel != NULL) ? index | THREAD_INDEX_OUTSIDE_OPENMP
+                                   : index;
+}
+
+/* Returns the seed of the generator of the thread, computed once per thread.
+ * The seed and the index are hashed, so that the xoshiro states of two
+ * threads are not consecutive outputs of a same splitmix64 sequence */
+static uint64_t _rng_ring_seed_value(thread_state_t *state,
+                                     const cancellation_context_t *ctx) {
+  if (!ctx->choose_seed) {
+    return get_rand_uint64(_get_rng_state(state, ctx), &state->tid);
+  }
+  if (!state->thread_index_is_set) {
+    state->thread_index = _thread_index();
+    state->thread_index_is_set = true;
+  }
+  return _rng_mix64(ctx->seed ^ _rng_mix64(state->thread_index + 1ULL));
+}
+
+static void _rng_ring_seed(rng_ring_t *ring, uint64_t x) {
+  for (int i = 0; i < 4; i++) {
+    for (int lane = 0; lane < RNG_LANES; lane++) {
+      ring->s[i][lane] = _splitmix64(&x);
+    }
+  }
+  ring->is_init = true;
+}
+
+/* Advances the RNG_LANES streams, writes one output per stream */
+static inline void _rng_ring_next(rng_ring_t *ring, uint64_t *result) {
+  for (int lane = 0; lane < RNG_LANES; lane++) {
+    result[lane] = ring->s[0][lane] + ring->s[3][lane];
+    const uint64_t t = ring->s[1][lane] << 17;
+    ring->s[2][lane] ^= ring->s[0][lane];
+    ring->s[3][lane] ^= ring->s[1][lane];
+    ring->s[1][lane] ^= ring->s[2][lane];
+    ring->s[0][lane] ^= ring->s[3][lane];
+    ring->s[2][lane] ^= t;
+    ring->s[3][lane] = _rng_rotl(ring->s[3][lane], 45);
+  }
+}
+
+static void _rng_ring_refill(rng_ring_t *ring) {
+  _profile_refill();
+  uint64_t result[RNG_LANES];
+  for (int i = 0; i < RNG_RING_SIZE; i += RNG_LANES) {
+    _rng_ring_next(ring, result);
+    for (int lane = 0; lane < RNG_LANES; lane++) {
+      /* the 52 high bits as the mantissa of a double in [1, 2), which avoids
+       * an integer to double conversion */
+      binary64 b64 = {.u64 = (result[lane] >> 12) | 0x3FF0000000000000ULL};
+      ring->values[i + lane] = b64.f64 - 1.5;
+    }
+  }
+  ring->remaining = RNG_RING_SIZE;
+}
+
+static void _rng_ring_refill_binary32(rng_ring_t *ring) {
+  _profile_refill();
+  uint64_t result[RNG_LANES];
+  for (int i = 0; i < 2 * RNG_RING_SIZE; i += 2 * RNG_LANES) {
+    _rng_ring_next(ring, result);
+    for (int lane = 0; lane < RNG_LANES; lane++) {
+      /* 23 bits of each 32-bit half as the mantissa of a float in [1, 2) */
+      binary32 lo = {.u32 = ((uint32_t)result[lane] >> 9) | 0x3F800000U};
+      binary32 hi = {.u32 = (uint32_t)(result[lane] >> 41) | 0x3F800000U};
+      ring->values_binary32[i + lane] = lo.f32 - 1.5f;
+      ring->values_binary32[i + RNG_LANES + lane] = hi.f32 - 1.5f;
+    }
+  }
+  ring->remaining_binary32 = 2 * RNG_RING_SIZE;
+}
+
+static void _rng_ring_refill_signs(rng_ring_t *ring) {
+  _profile_refill();
+  _rng_ring_next(ring, ring->signs);
+  ring->remaining_signs = 64 * RNG_LANES;
+}
+
+static __attribute__((noinline)) void
+_rng_ring_reload(thread_state_t *state, const cancellation_context_t *ctx) {
+  if (!state->rng_ring.is_init) {
+    _rng_ring_seed(&state->rng_ring, _rng_ring_seed_value(state, ctx));
+  }
+  _rng_ring_refill(&state->rng_ring);
+}
+
+static __attribute__((noinline)) void
+_rng_ring_reload_binary32(thread_state_t *state,
+                          const cancellation_context_t *ctx) {
+  if (!state->rng_ring.is_init) {
+    _rng_ring_seed(&state->rng_ring, _rng_ring_seed_value(state, ctx));
+  }
+  _rng_ring_refill_binary32(&state->rng_ring);
+}
+
+static __attribute__((noinline)) void
+_rng_ring_reload_signs(thread_state_t *state,
+                       const cancellation_context_t *ctx) {
+  if (!state->rng_ring.is_init) {
+    _rng_ring_seed(&state->rng_ring, _rng_ring_seed_value(state, ctx));
+  }
+  _rng_ring_refill_signs(&state->rng_ring);
+}
+
+/* Returns a random number in [-0.5, 0.5) */
+static inline double _get_rand(const cancellation_context_t *ctx) {
+  _profile_draws(1);
+  thread_state_t *state = _get_thread_state();
+  if (__builtin_expect(state->rng_state_is_pushed, 0)) {
+    return get_rand_double01(&state->rng_state, &state->tid) - 0.5;
+  }
+  if (__builtin_expect(state->rng_ring.remaining == 0, 0)) {
+    _rng_ring_reload(state, ctx);
+  }
+  return state->rng_ring.values[--state->rng_ring.remaining];
+}
+
+/* Returns a random binary32 number in [-0.5, 0.5) */
+static inline float _get_rand_binary32(const cancellation_context_t *ctx) {
+  _profile_draws(1);
+  thread_state_t *state = _get_thread_state();
+  if (__builtin_expect(state->rng_state_is_pushed, 0)) {
+    return (float)(get_rand_double01(&state->rng_state, &state->tid) - 0.5);
+  }
+  if (__builtin_expect(state->rng_ring.remaining_binary32 == 0, 0)) {
+    _rng_ring_reload_binary32(state, ctx);
+  }
+  return state->rng_ring.values_binary32[--state->rng_ring.remaining_binary32];
+}
+
+/* Returns a random bit */
+static inline uint64_t _get_rand_sign(const cancellation_context_t *ctx) {
+  _profile_draws(1);
+  thread_state_t *state = _get_thread_state();
+  if (__builtin_expect(state->rng_state_is_pushed, 0)) {
+    return get_rand_uint64(&state->rng_state, &state->tid) >> 63;
+  }
+  if (__builtin_expect(state->rng_ring.remaining_signs == 0, 0)) {
+    _rng_ring_reload_signs(state, ctx);
+  }
+  const uint32_t i = --state->rng_ring.remaining_signs;
+  return (state->rng_ring.signs[i / 64] >> (i % 64)) & 1;
+}
+
+/* Defines the noises of binaryBITS:
+ *
+ * _add_noise_binaryBITS(x, rand, exp) returns x + rand * 2^exp, with rand in
+ * [-0.5, 0.5). When rand is not zero and the noise is a normal number, rand
+ * is scaled by adding exp to its exponent. The other noises are zero,
+ * subnormal or below the subnormals, as are the ones of the total
+ * cancellations among small numbers and of the cancellations with a
+ * subnormal result. _add_noise_tiny_binaryBITS computes them for any exp:
+ * - if x is zero or subnormal and the noise is non-zero and below the normal
+ *   numbers, x and the noise are counted in units of the smallest subnormal
+ *   2^E_MIN. The noise, below 2^PMAN_SIZE units, is the significand of rand
+ *   shifted to the units and rounded to nearest even, and their sum is exact
+ *   and below 2^(PMAN_SIZE + 1) units, so that the integer is also the
+ *   encoding of the sum. No floating-point operation has a subnormal result,
+ *   each of which costs a microcode assist of about a hundred cycles on
+ *   x86;
+ * - otherwise rand is multiplied by 2^exp with exp saturated to the normal
+ *   and subnormal exponents, the power of two being built from its bits.
+ * Below 2^E_MIN, the noise is at most half a unit and rounds to zero, as it
+ * does once saturated. Both round the noise once then add it, as the
+ * floating-point x + rand * 2^exp does, unless it overflows. x is never a
+ * negative zero: the zero result of a cancellation is +0 in rounding to
+ * nearest. */
+#define define_add_noise(BITS, TYPE, UINT, INT, PMAN_SIZE, EXP_COMP)           \
+  /* 2^e, for the exponents of the normal and subnormal numbers */             \
+  static inline TYPE _pow2_binary##BITS(const int32_t e) {                     \
+    const int32_t biased = e + EXP_COMP;                                       \
+    const binary##BITS p = {.u##BITS = (biased > 0)                            \
+                                           ? (UINT)biased << PMAN_SIZE         \
+                                           : (UINT)1                           \
+                                                 << (biased + PMAN_SIZE - 1)}; \
+    return p.f##BITS;                                                          \
+  }                                                                            \
+                                                                               \
+  static inline TYPE _add_noise_tiny_binary##BITS(                             \
+      const TYPE x, const TYPE rand, const int32_t exp) {                      \
+    const int32_t E_MIN = -(EXP_COMP + PMAN_SIZE - 1);                         \
+    binary##BITS b = {.f##BITS = x};                                           \
+    const binary##BITS r = {.f##BITS = rand};                                  \
+    const int32_t e = (int32_t)r.ieee.exponent;                                \
+    if (b.ieee.exponent != 0 || e == 0 || e + exp > 0) {                       \
+      return x + rand * _pow2_binary##BITS(min(max(exp, E_MIN), EXP_COMP));    \
+    }                                                                          \
+    /* the shift saturates past the significand, which then rounds to zero */  \
+    const UINT significand = r.ieee.mantissa | (UINT)1 << PMAN_SIZE;           \
+    const int32_t shift = min(1 - (e + exp), PMAN_SIZE + 2);                   \
+    const UINT half = (UINT)1 << (shift - 1);                                  \
+    const UINT rest = significand & ((half << 1) - 1);                         \
+    const UINT truncated = significand >> shift;                               \
+    const INT noise =                                                          \
+        (INT)(truncated + ((rest > half) | ((rest == half) & truncated & 1))); \
+    const INT mantissa = (INT)b.ieee.mantissa;                                 \
+    const INT sum =                                                            \
+        (r.ieee.sign ? -noise : noise) + (b.ieee.sign ? -mantissa : mantissa); \
+    b.u##BITS = (UINT)((sum < 0) ? -sum : sum);                                \
+    b.ieee.sign = sum < 0;                                                     \
+    return b.f##BITS;                                                          \
+  }                                                                            \
+                                                                               \
+  static inline TYPE _add_noise_binary##BITS(const TYPE x, const TYPE rand,    \
+                                             const int32_t exp) {              \
+    binary##BITS b = {.f##BITS = rand};                                        \
+    const int32_t e = (int32_t)b.ieee.exponent;                                \
+    /* the biased exponents of the normal numbers are 1 to 2 * EXP_COMP */     \
+    if (__builtin_expect((e == 0) | ((uint32_t)(e + exp - 1) >= 2 * EXP_COMP), \
+                         0)) {                                                 \
+      return _add_noise_tiny_binary##BITS(x, rand, exp);                       \
     }                                                                          \
+    b.ieee.exponent = e + exp;                                                 \
+    return x + b.f##BITS;                                                      \
   }
 
+define_add_noise(32, float, uint32_t, int32_t, FLOAT_PMAN_SIZE, FLOAT_EXP_COMP);
+define_add_noise(64, double, uint64_t, int64_t, DOUBLE_PMAN_SIZE,
+                 DOUBLE_EXP_COMP);
+
+/* x + rand * 2^(exp) */
+static inline double _noise_binary64(const double x, const int exp,
+                                     const cancellation_context_t *ctx) {
+  return _add_noise_binary64(x, _get_rand(ctx), exp);
+}
+
+static inline float _noise_binary32(const float x, const int exp,
+                                    const cancellation_context_t *ctx) {
+  return _add_noise_binary32(x, _get_rand_binary32(ctx), exp);
+}
+
+#define NOISE(X, EXP, CTX)                                                     \
+  _Generic((X), float: _noise_binary32, double: _noise_binary64)(X, EXP, CTX)
+
+/* Fills d_rand with n random numbers in [-0.5, 0.5), the ones n calls of
+ * _get_rand would return. The state is looked up once, and the numbers are
+ * copied from the ring in runs, a run per refill */
+static void _rand_fill_binary64(double *d_rand, const int n,
+                                const cancellation_context_t *ctx) {
+  _profile_draws(n);
+  thread_state_t *state = _get_thread_state();
+  rng_ring_t *ring = &state->rng_ring;
+  for (int i = 0; i < n;) {
+    if (__builtin_expect(state->rng_state_is_pushed, 0)) {
+      d_rand[i++] = get_rand_double01(&state->rng_state, &state->tid) - 0.5;
+      continue;
+    }
+    if (__builtin_expect(ring->remaining == 0, 0)) {
+      _rng_ring_reload(state, ctx);
+    }
+    const int run = min(n - i, (int)ring->remaining);
+    for (int j = 0; j < run; j++) {
+      d_rand[i + j] = ring->values[ring->remaining - 1 - j];
+    }
+    ring->remaining -= run;
+    i += run;
+  }
+}
+
+static void _rand_fill_binary32(float *f_rand, const int n,
+                                const cancellation_context_t *ctx) {
+  _profile_draws(n);
+  thread_state_t *state = _get_thread_state();
+  rng_ring_t *ring = &state->rng_ring;
+  for (int i = 0; i < n;) {
+    if (__builtin_expect(state->rng_state_is_pushed, 0)) {
+      f_rand[i++] =
+          (float)(get_rand_double01(&state->rng_state, &state->tid) - 0.5);
+      continue;
+    }
+    if (__builtin_expect(ring->remaining_binary32 == 0, 0)) {
+      _rng_ring_reload_binary32(state, ctx);
+    }
+    const int run = min(n - i, (int)ring->remaining_binary32);
+    for (int j = 0; j < run; j++) {
+      f_rand[i + j] = ring->values_binary32[ring->remaining_binary32 - 1 - j];
+    }
+    ring->remaining_binary32 -= run;
+    i += run;
+  }
+}
+
+static const char *CANCELLATION_WARNING_MODE_STR[] = {"immediate", "buffered"};
+
+static const char *CANCELLATION_MODE_STR[] = {"mca", "detect"};
+
+static const char *CANCELLATION_NOISE_STR[] = {"uniform", "sign", "truncate"};
+
+static const char *CANCELLATION_THREAD_STORAGE_STR[] = {"tls", "table"};
+
+/* Number of buckets used to count cancellations by size. Sizes larger than
+ * the binary64 significand are all counted in the last bucket */
+#define REPORT_BUCKETS (DOUBLE_PMAN_SIZE + 2)
+
+/* per-thread buffer of warnings */
+typedef struct report_buffer {
+  /* number of buffered events per cancellation size */
+  uint64_t counts[REPORT_BUCKETS];
+  /* number of buffered events since the last flush */
+  uint64_t pending;
+  /* number of events seen by the thread, used for sampling */
+  uint64_t events;
+  struct report_buffer *next;
+} report_buffer_t;
+
+/* list of the buffers of all threads, walked at finalize */
+static report_buffer_t *report_buffers = NULL;
+/* counts merged from the flushed buffers since the last periodic write */
+static uint64_t report_counts[REPORT_BUCKETS];
+/* counts written by the periodic writes, the totals are written at finalize */
+static uint64_t report_totals[REPORT_BUCKETS];
+/* number of lines written so far */
+static uint64_t report_lines = 0;
+/* set while a thread writes the merged counts */
+static bool report_writing = false;
+
+/* Allocates the buffer of the calling thread and registers it in the list */
+static report_buffer_t *_new_report_buffer(void) {
+  report_buffer_t *buffer =
+      (report_buffer_t *)_arena_alloc(sizeof(report_buffer_t));
+  *buffer = (report_buffer_t){{0}, 0, 0, NULL};
+  list_push(&report_buffers, buffer);
+  return buffer;
+}
+
+static inline report_buffer_t *_get_report_buffer(thread_state_t *state) {
+  if (__builtin_expect(state->report_buffer == NULL, 0)) {
+    state->report_buffer = _new_report_buffer();
+  }
+  return state->report_buffer;
+}
+
+/* Reserves one line of output. Returns false once warning_max_lines lines
+ * have been written */
+static bool _report_reserve_line(const cancellation_context_t *ctx) {
+  if (ctx->warning_max_lines == 0) {
+    return true;
+  }
+  const uint64_t line =
+      __atomic_fetch_add(&report_lines, 1, __ATOMIC_RELAXED);
+  if (line == ctx->warning_max_lines) {
+    logger_info("maximum number of warning lines reached (%lu), further "
+                "warnings are discarded\n",
+                ctx->warning_max_lines);
+  }
+  return line < ctx->warning_max_lines;
+}
+
+/* Moves the counts of buffer into the merged counts */
+static void _report_merge(report_buffer_t *buffer) {
+  for (int i = 0; i < REPORT_BUCKETS; i++) {
+    if (buffer->counts[i] != 0) {
+      __atomic_fetch_add(&report_counts[i], buffer->counts[i],
+                         __ATOMIC_RELAXED);
+      buffer->counts[i] = 0;
+    }
+  }
+  buffer->pending = 0;
+}
+
+/* Writes the line of the bucket i of the counts */
+static void _report_line(const int i, const uint64_t count,
+                         const char *suffix) {
+  if (i == REPORT_BUCKETS - 1) {
+    logger_info("cancellation of size > %d detected %lu times%s\n",
+                REPORT_BUCKETS - 2, count, suffix);
+  } else {
+    logger_info("cancellation of size %d detected %lu times%s\n", i, count,
+                suffix);
+  }
+}
+
+/* Writes the counts merged since the last periodic write, within the
+ * warning_max_lines lines, and moves them to the totals */
+static void _report_write_period(const cancellation_context_t *ctx) {
+  for (int i = 0; i < REPORT_BUCKETS; i++) {
+    const uint64_t count =
+        __atomic_exchange_n(&report_counts[i], 0, __ATOMIC_RELAXED);
+    if (count == 0) {
+      continue;
+    }
+    __atomic_fetch_add(&report_totals[i], count, __ATOMIC_RELAXED);
+    if (_report_reserve_line(ctx)) {
+      _report_line(i, count, " since the last report");
+    }
+  }
+}
+
+/* Writes the totals of the run, which are not limited by warning_max_lines */
+static void _report_write_totals(void) {
+  for (int i = 0; i < REPORT_BUCKETS; i++) {
+    const uint64_t count =
+        __atomic_load_n(&report_totals[i], __ATOMIC_RELAXED) +
+        __atomic_exchange_n(&report_counts[i], 0, __ATOMIC_RELAXED);
+    if (count != 0) {
+      _report_line(i, count, "");
+    }
+  }
+}
+
+/* Merges the buffer of the calling thread and writes the counts of the
+ * period. The write is skipped if another thread is already writing, the
+ * counts are then written by the next one */
+static void _report_flush(report_buffer_t *buffer,
+                          const cancellation_context_t *ctx) {
+  _report_merge(buffer);
+  if (!__atomic_exchange_n(&report_writing, true, __ATOMIC_ACQUIRE)) {
+    _report_write_period(ctx);
+    __atomic_store_n(&report_writing, false, __ATOMIC_RELEASE);
+  }
+}
+
+/* Reports a cancellation of size cancellation according to the warning mode */
+static void _report_cancellation(thread_state_t *state, int cancellation,
+                                 const cancellation_context_t *ctx) {
+  report_buffer_t *buffer = _get_report_buffer(state);
+  if (ctx->warning_mode == cancellation_warning_mode_buffered) {
+    buffer->counts[cancellation < REPORT_BUCKETS - 1 ? cancellation
+                                                     : REPORT_BUCKETS - 1]++;
+    if (ctx->warning_period != 0 && ++buffer->pending >= ctx->warning_period) {
+      _report_flush(buffer, ctx);
+    }
+  } else if (buffer->events++ % ctx->warning_sample_rate == 0 &&
+             _report_reserve_line(ctx)) {
+    logger_info("cancellation of size %d detected\n", cancellation);
+  }
+}
+
+static const char *CANCELLATION_HISTOGRAM_FORMAT_STR[] = {"csv", "json"};
+
+typedef enum {
+  precision_binary32,
+  precision_binary64,
+  _precision_end_
+} precision_t;
+
+#define PRECISION(X)                                                           \
+  _Generic((X), float: precision_binary32, double: precision_binary64)
+
+static const char *PRECISION_STR[] = {"binary32", "binary64"};
+
+/* Number of buckets of the histogram by precision. The last bucket counts the
+ * cancellations larger than the significand */
+static const int HISTOGRAM_BUCKETS[] = {FLOAT_PMAN_SIZE + 2,
+                                        DOUBLE_PMAN_SIZE + 2};
+
+/* per-thread histogram of cancellation sizes */
+typedef struct histogram {
+  uint64_t counts[_precision_end_][DOUBLE_PMAN_SIZE + 2];
+  struct histogram *next;
+} histogram_t;
+
+/* list of the histograms of all threads, reduced at finalize */
+static histogram_t *histograms = NULL;
+
+static histogram_t *_new_histogram(void) {
+  histogram_t *h = (histogram_t *)_arena_alloc(sizeof(histogram_t));
+  *h = (histogram_t){{{0}}, NULL};
+  list_push(&histograms, h);
+  return h;
+}
+
+/* Counts a cancellation in the histogram of the thread of state. The counter
+ * is only written by its thread so a relaxed load and store is enough, the
+ * relaxed accesses make the reads of finalize well-defined */
+static inline void _histogram_add(thread_state_t *state,
+                                  const precision_t precision,
+                                  const int cancellation) {
+  if (__builtin_expect(state->histogram == NULL, 0)) {
+    state->histogram = _new_histogram();
+  }
+  const int last = HISTOGRAM_BUCKETS[precision] - 1;
+  uint64_t *count =
+      &state->histogram->counts[precision][cancellation < last ? cancellation
+                                                               : last];
+  __atomic_store_n(count, __atomic_load_n(count, __ATOMIC_RELAXED) + 1,
+                   __ATOMIC_RELAXED);
+}
+
+/* Sums the histograms of all threads into total */
+static void _histogram_reduce(histogram_t *total) {
+  *total = (histogram_t){{{0}}, NULL};
+  histogram_t *h = __atomic_load_n(&histograms, __ATOMIC_ACQUIRE);
+  for (; h != NULL; h = h->next) {
+    for (int p = 0; p < _precision_end_; p++) {
+      for (int i = 0; i < HISTOGRAM_BUCKETS[p]; i++) {
+        total->counts[p][i] += __atomic_load_n(&h->counts[p][i],
+                                               __ATOMIC_RELAXED);
+      }
+    }
+  }
+}
+
+static void _histogram_write_csv(File *stream, const histogram_t *h) {
+  interflop_fprintf(stream, "precision,size,count\n");
+  for (int p = 0; p < _precision_end_; p++) {
+    const int last = HISTOGRAM_BUCKETS[p] - 1;
+    for (int i = 0; i < last; i++) {
+      interflop_fprintf(stream, "%s,%d,%lu\n", PRECISION_STR[p], i,
+                        h->counts[p][i]);
+    }
+    interflop_fprintf(stream, "%s,>%d,%lu\n", PRECISION_STR[p], last - 1,
+                      h->counts[p][last]);
+  }
+}
+
+static void _histogram_write_json(File *stream, const histogram_t *h) {
+  interflop_fprintf(stream, "{\n");
+  for (int p = 0; p < _precision_end_; p++) {
+    const int last = HISTOGRAM_BUCKETS[p] - 1;
+    interflop_fprintf(stream, "  \"%s\": {\n    \"counts\": [",
+                      PRECISION_STR[p]);
+    for (int i = 0; i < last; i++) {
+      interflop_fprintf(stream, "%s%lu", (i == 0) ? "" : ", ", h->counts[p][i]);
+    }
+    interflop_fprintf(stream, "],\n    \"larger\": %lu\n  }%s\n",
+                      h->counts[p][last],
+                      (p == _precision_end_ - 1) ? "" : ",");
+  }
+  interflop_fprintf(stream, "}\n");
+}
+
+/* Writes the reduced histogram total */
+static void _histogram_write_total(const cancellation_context_t *ctx,
+                                   const histogram_t *total) {
+  int error = 0;
+  File *stream = interflop_fopen(ctx->histogram_file, "w", &error);
+  if (stream == NULL) {
+    logger_warning("cannot open histogram file %s: %s\n", ctx->histogram_file,
+                   interflop_strerror(error));
+    return;
+  }
+
+  switch (ctx->histogram_format) {
+  case cancellation_histogram_format_json:
+    _histogram_write_json(stream, total);
+    break;
+  default:
+    _histogram_write_csv(stream, total);
+    break;
+  }
+  interflop_fclose(stream, &error);
+}
+
+/* Reduces the histograms of all threads and writes the result */
+static void _histogram_write(const cancellation_context_t *ctx) {
+  histogram_t total;
+  _histogram_reduce(&total);
+  _histogram_write_total(ctx, &total);
+}
+
+/* Function tolerances: with --tolerance-file, the tolerance can be set per
+ * function, or the function excluded from the checking, from a file of
+ * "function tolerance" lines, where the tolerance is a non-negative integer
+ * or "exclude". The functions are identified as in the report of
+ * --top-functions. Empty lines and lines starting with '#' are ignored.
+ *
+ * The file is loaded once at init into an array sorted by name. The
+ * tolerance of a function is looked up when it enters the function table of
+ * a thread, and is kept in its entry. A thread copies it in its state when it
+ * enters the function, so that entering a function costs no extra lookup,
+ * except for the functions of a full table: they share the overflow entry,
+ * and their tolerance is looked up each time. */
+
+/* Tolerance of a function excluded from the checking */
+#define TOLERANCE_EXCLUDED INT32_MAX
+/* Tolerance of a function absent from the file, the one of the context */
+#define TOLERANCE_GLOBAL -1
+
+typedef struct {
+  char *function;
+  int32_t tolerance;
+} function_tolerance_t;
+
+/* sorted tolerances of the file, NULL without --tolerance-file */
+static function_tolerance_t *function_tolerances = NULL;
+static int function_tolerances_size = 0;
+
+/* Loads the tolerance file of the context */
+static void _function_tolerances_load(const cancellation_context_t *ctx) {
+  int error = 0;
+  File *stream = interflop_fopen(ctx->tolerance_file, "r", &error);
+  if (stream == NULL) {
+    logger_error("cannot open tolerance file %s: %s\n", ctx->tolerance_file,
+                 interflop_strerror(error));
+  }
+  int capacity = 0;
+  char line[4096];
+  for (int number = 1; interflop_fgets(line, sizeof(line), stream) != NULL;
+       number++) {
+    char *saveptr = NULL;
+    const char *function = interflop_strtok_r(line, " \t\n", &saveptr);
+    if (function == NULL || function[0] == '#') {
+      continue;
+    }
+    const char *value = interflop_strtok_r(NULL, " \t\n", &saveptr);
+    int32_t tolerance = TOLERANCE_EXCLUDED;
+    if (value == NULL) {
+      logger_error("%s:%d: missing tolerance for %s\n", ctx->tolerance_file,
+                   number, function);
+    } else if (interflop_strcasecmp(value, "exclude") != 0) {
+      char *endptr;
+      error = 0;
+      const long parsed = interflop_strtol(value, &endptr, &error);
+      if (error != 0 || *endptr != '\0' || parsed < 0 || parsed > INT32_MAX) {
+        logger_error("%s:%d: invalid tolerance %s, must be a positive "
+                     "integer or exclude\n",
+                     ctx->tolerance_file, number, value);
+      }
+      tolerance = (int32_t)parsed;
+    }
+    if (function_tolerances_size == capacity) {
+      capacity = (capacity == 0) ? 64 : 2 * capacity;
+      function_tolerance_t *grown = (function_tolerance_t *)_arena_alloc(
+          capacity * sizeof(function_tolerance_t));
+      for (int i = 0; i < function_tolerances_size; i++) {
+        grown[i] = function_tolerances[i];
+      }
+      function_tolerances = grown;
+    }
+    char *name = (char *)_arena_alloc(strlen(function) + 1);
+    interflop_sprintf(name, "%s", function);
+    /* insertion sort, the files are small */
+    int i = function_tolerances_size++;
+    for (; i > 0 && interflop_strcmp(function_tolerances[i - 1].function,
+                                     name) > 0;
+         i--) {
+      function_tolerances[i] = function_tolerances[i - 1];
+    }
+    function_tolerances[i] = (function_tolerance_t){name, tolerance};
+  }
+  interflop_fclose(stream, &error);
+  if (function_tolerances == NULL) {
+    /* an empty file, keep the lookups enabled */
+    function_tolerances = (function_tolerance_t *)_arena_alloc(
+        sizeof(function_tolerance_t));
+  }
+  logger_info("interflop_cancellation: loaded %d function tolerances from "
+              "%s\n",
+              function_tolerances_size, ctx->tolerance_file);
+}
+
+/* Returns the tolerance of the file for function, or TOLERANCE_GLOBAL */
+static int32_t
+_function_tolerance_lookup(const interflop_function_info_t *function) {
+  int low = 0, high = function_tolerances_size;
+  while (low < high) {
+    const int mid = (low + high) / 2;
+    const int order =
+        interflop_strcmp(function_tolerances[mid].function, function->id);
+    if (order == 0) {
+      return function_tolerances[mid].tolerance;
+    }
+    if (order < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return TOLERANCE_GLOBAL;
+}
+
+/* Capacity of the per-thread function tables, must be a power of two */
+#define FUNCTION_TABLE_SIZE 4096
+/* Number of functions accepted in a table before new functions are counted
+ * in the overflow entry, keeps the probe sequences short */
+#define FUNCTION_TABLE_LOAD (FUNCTION_TABLE_SIZE / 4 * 3)
+
+/* cancellations attributed to a function */
+typedef struct function_entry {
+  /* key, the function info is unique for a function and lives for the whole
+   * execution */
+  const interflop_function_info_t *function;
+  uint64_t count;
+  int32_t max;
+  /* tolerance of the function, TOLERANCE_GLOBAL if not set by the tolerance
+   * file */
+  int32_t tolerance;
+} function_entry_t;
+
+/* per-thread open-addressing table of function entries. The table is
+ * allocated once per thread, entries are never allocated */
+typedef struct function_table {
+  function_entry_t entries[FUNCTION_TABLE_SIZE];
+  /* cancellations of the functions that did not fit in the table */
+  function_entry_t overflow;
+  uint32_t size;
+  struct function_table *next;
+} function_table_t;
+
+/* list of the function tables of all threads, merged at finalize */
+static function_table_t *function_tables = NULL;
+
+static function_table_t *_new_function_table(void) {
+  function_table_t *table =
+      (function_table_t *)_arena_alloc(sizeof(function_table_t));
+  for (int i = 0; i < FUNCTION_TABLE_SIZE; i++) {
+    table->entries[i] = (function_entry_t){NULL, 0, 0, TOLERANCE_GLOBAL};
+  }
+  table->overflow = (function_entry_t){NULL, 0, 0, TOLERANCE_GLOBAL};
+  table->size = 0;
+  table->next = NULL;
+  return table;
+}
+
+static inline function_table_t *_get_function_table(thread_state_t *state) {
+  if (__builtin_expect(state->function_table == NULL, 0)) {
+    state->function_table = _new_function_table();
+    list_push(&function_tables, state->function_table);
+  }
+  return state->function_table;
+}
+
+static inline uint32_t _function_hash(const interflop_function_info_t *f) {
+  /* Fibonacci hashing of the address, the low bits are alignment */
+  return (uint32_t)(((uintptr_t)f >> 4) * 0x9E3779B97F4A7C15ULL >> 32) &
+         (FUNCTION_TABLE_SIZE - 1);
+}
+
+/* Returns the entry of function in table, inserting it if needed */
+static function_entry_t *
+_function_table_get(function_table_t *table,
+                    const interflop_function_info_t *function) {
+  uint32_t i = _function_hash(function);
+  for (;; i = (i + 1) & (FUNCTION_TABLE_SIZE - 1)) {
+    function_entry_t *entry = &table->entries[i];
+    if (entry->function == function) {
+      return entry;
+    }
+    if (entry->function == NULL) {
+      if (table->size == FUNCTION_TABLE_LOAD) {
+        return &table->overflow;
+      }
+      table->size++;
+      if (function_tolerances != NULL) {
+        entry->tolerance = _function_tolerance_lookup(function);
+      }
+      __atomic_store_n(&entry->function, function, __ATOMIC_RELEASE);
+      return entry;
+    }
+  }
+}
+
+/* Makes function, or none if NULL, the one executed by the thread of state */
+static inline void _function_enter(thread_state_t *state,
+                                   const interflop_function_info_t *function) {
+  if (function == NULL) {
+    state->function_entry = NULL;
+    return;
+  }
+  function_entry_t *entry =
+      _function_table_get(_get_function_table(state), function);
+  state->function_entry = entry;
+  if (__builtin_expect(function_tolerances != NULL, 0)) {
+    /* the overflow entry has no function */
+    state->function_tolerance = (entry->function == function)
+                                    ? entry->tolerance
+                                    : _function_tolerance_lookup(function);
+  }
+}
+
+/* Attributes a cancellation to the function currently executed */
+static inline void _function_add(function_entry_t *entry,
+                                 const int cancellation) {
+  __atomic_store_n(&entry->count,
+                   __atomic_load_n(&entry->count, __ATOMIC_RELAXED) + 1,
+                   __ATOMIC_RELAXED);
+  if (cancellation > entry->max) {
+    __atomic_store_n(&entry->max, cancellation, __ATOMIC_RELAXED);
+  }
+}
+
+static void _function_merge(function_entry_t *to,
+                            const function_entry_t *from) {
+  to->count += __atomic_load_n(&from->count, __ATOMIC_RELAXED);
+  const int32_t max = __atomic_load_n(&from->max, __ATOMIC_RELAXED);
+  to->max = max > to->max ? max : to->max;
+}
+
+/* Returns a new table merging the tables of all threads */
+static function_table_t *_function_tables_merge(void) {
+  function_table_t *total = _new_function_table();
+  function_table_t *table =
+      __atomic_load_n(&function_tables, __ATOMIC_ACQUIRE);
+  for (; table != NULL; table = table->next) {
+    for (int i = 0; i < FUNCTION_TABLE_SIZE; i++) {
+      const interflop_function_info_t *function =
+          __atomic_load_n(&table->entries[i].function, __ATOMIC_ACQUIRE);
+      if (function != NULL) {
+        _function_merge(_function_table_get(total, function),
+                        &table->entries[i]);
+      }
+    }
+    _function_merge(&total->overflow, &table->overflow);
+  }
+  return total;
+}
+
+/* Reports the top_functions entries with the largest number of
+ * cancellations, among the n entries, which are consumed */
+static void _function_report_entries(const cancellation_context_t *ctx,
+                                     function_entry_t *entries, const int n,
+                                     const uint64_t overflow) {
+  logger_info("top %d functions by number of cancellations:\n",
+              ctx->top_functions);
+  /* partial selection sort, top_functions is expected to be small */
+  for (int rank = 1; rank <= ctx->top_functions; rank++) {
+    function_entry_t *top = NULL;
+    for (int i = 0; i < n; i++) {
+      function_entry_t *entry = &entries[i];
+      if (entry->count != 0 && (top == NULL || entry->count > top->count)) {
+        top = entry;
+      }
+    }
+    if (top == NULL) {
+      break;
+    }
+    logger_info("  #%d %s: %lu cancellations, max size %d\n", rank,
+                top->function->id, top->count, top->max);
+    top->count = 0;
+  }
+  if (overflow != 0) {
+    logger_info("  (%lu cancellations in functions not tracked, the table "
+                "is full)\n",
+                overflow);
+  }
+}
+
+/* Merges the tables of all threads and reports the top_functions functions
+ * with the largest number of cancellations */
+static void _function_report(const cancellation_context_t *ctx) {
+  function_table_t *total = _function_tables_merge();
+  _function_report_entries(ctx, total->entries, FUNCTION_TABLE_SIZE,
+                           total->overflow.count);
+}
+
+/* true if the checks update the per-thread state of every operation, for the
+ * sampling, the live counters or the hook of --mpi-reduce. Otherwise the
+ * operations that do not cancel are filtered before the per-thread state is
+ * accessed */
+static bool per_operation_state = false;
+
+/* With --mpi-reduce, the histograms and the function tables of all the MPI
+ * ranks are merged into a single report written by rank 0, instead of one
+ * report per rank. MPI is detected at runtime: its functions are weak
+ * references, resolved when the program links an MPI library, and mpi.h is
+ * not included so that the backend builds without MPI. The handles of the
+ * predefined objects come from the two ABIs in use: the addresses of the
+ * predefined objects of Open MPI, and the integer constants of MPICH and its
+ * derivatives (Intel MPI, MVAPICH, Cray MPICH).
+ *
+ * The backend is finalized after MPI, so the reduction runs at the start of
+ * MPI_Finalize, from the delete callback of an attribute of MPI_COMM_SELF.
+ * The main thread sets the attribute on its first entry in the backend after
+ * MPI_Init: a checked operation, an array operation, a function entry or a
+ * user call. MPI_Init is not wrapped, as a wrapper exported by the backend
+ * would be called in place of the one of the library, or of the other tools
+ * of the profiling interface, depending on the order of the loading.
+ *
+ * The summaries of the ranks are merged along a binomial tree, in log2(P)
+ * steps. Every wait of the reduction is bounded, so that a rank that does not
+ * join it, or joins it late, is left out instead of blocking its parent: the
+ * ranks whose summary is not collected write the reports of their subtree.
+ * The cancellations after MPI_Finalize are not reported. */
+
+#define _u_ __attribute__((unused))
+
+extern int MPI_Initialized(int *flag) __attribute__((weak));
+extern int MPI_Finalized(int *flag) __attribute__((weak));
+/* the other functions take handles, they are cast to the types of the ABI */
+extern void MPI_Comm_rank(void) __attribute__((weak));
+extern void MPI_Comm_size(void) __attribute__((weak));
+extern void MPI_Comm_create_keyval(void) __attribute__((weak));
+extern void MPI_Comm_set_attr(void) __attribute__((weak));
+extern void MPI_Send(void) __attribute__((weak));
+extern void MPI_Recv(void) __attribute__((weak));
+extern void MPI_Iprobe(void) __attribute__((weak));
+
+/* predefined objects of Open MPI */
+extern char ompi_mpi_comm_world[] __attribute__((weak));
+extern char ompi_mpi_comm_self[] __attribute__((weak));
+extern char ompi_mpi_byte[] __attribute__((weak));
+
+/* predefined handles of MPICH */
+#define MPICH_COMM_WORLD 0x44000000
+#define MPICH_COMM_SELF 0x44000001
+#define MPICH_BYTE 0x4c00010d
+
+/* tag of the messages of the reduction */
+#define MPI_REDUCE_TAG 0x1fc
+/* seconds a rank waits for a message of the reduction */
+#define MPI_REDUCE_TIMEOUT 30
+
+/* handle of a predefined MPI object, in the ABI of the library */
+typedef union {
+  void *ompi;
+  int mpich;
+} mpi_handle_t;
+
+/* opaque MPI_Status, larger than the one of both ABIs */
+typedef struct {
+  int fields[16];
+} mpi_status_t;
+
+typedef void (*mpi_function_t)(void);
+
+/* functions with handles, called through the types of the ABI */
+typedef struct {
+  mpi_function_t comm_rank;
+  mpi_function_t comm_size;
+  mpi_function_t comm_create_keyval;
+  mpi_function_t comm_set_attr;
+  mpi_function_t send;
+  mpi_function_t recv;
+  mpi_function_t iprobe;
+} mpi_functions_t;
+
+static mpi_functions_t mpi;
+
+/* true if the library has the Open MPI ABI */
+static bool mpi_ompi = false;
+static mpi_handle_t mpi_comm_world, mpi_comm_self, mpi_byte;
+/* state of the main thread until the attribute is set on MPI_COMM_SELF */
+static thread_state_t *mpi_main_state = NULL;
+/* per_operation_state once the attribute is set, set at init */
+static bool mpi_per_operation_state = false;
+/* true once the reports are written by the reduction */
+static bool mpi_reported = false;
+static const cancellation_context_t *mpi_context = NULL;
+
+static int _mpi_comm_rank(const mpi_handle_t comm, int *rank) {
+  return mpi_ompi ? ((int (*)(void *, int *))mpi.comm_rank)(comm.ompi, rank)
+                  : ((int (*)(int, int *))mpi.comm_rank)(comm.mpich, rank);
+}
+
+static int _mpi_comm_size(const mpi_handle_t comm, int *size) {
+  return mpi_ompi ? ((int (*)(void *, int *))mpi.comm_size)(comm.ompi, size)
+                  : ((int (*)(int, int *))mpi.comm_size)(comm.mpich, size);
+}
+
+static int _mpi_send(const void *buf, const uint64_t count, const int dest) {
+  return mpi_ompi
+             ? ((int (*)(const void *, int, void *, int, int, void *))mpi.send)(
+                   buf, (int)count, mpi_byte.ompi, dest, MPI_REDUCE_TAG,
+                   mpi_comm_world.ompi)
+             : ((int (*)(const void *, int, int, int, int, int))mpi.send)(
+                   buf, (int)count, mpi_byte.mpich, dest, MPI_REDUCE_TAG,
+                   mpi_comm_world.mpich);
+}
+
+static int _mpi_recv(void *buf, const uint64_t count, const int source) {
+  mpi_status_t status;
+  return mpi_ompi
+             ? ((int (*)(void *, int, void *, int, int, void *,
+                         mpi_status_t *))mpi.recv)(
+                   buf, (int)count, mpi_byte.ompi, source, MPI_REDUCE_TAG,
+                   mpi_comm_world.ompi, &status)
+             : ((int (*)(void *, int, int, int, int, int,
+                         mpi_status_t *))mpi.recv)(
+                   buf, (int)count, mpi_byte.mpich, source, MPI_REDUCE_TAG,
+                   mpi_comm_world.mpich, &status);
+}
+
+/* Waits at most seconds for a message from source, returns true if one is
+ * pending */
+static bool _mpi_wait(const int source, const int seconds) {
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  do {
+    int flag = 0;
+    mpi_status_t status;
+    if (mpi_ompi) {
+      ((int (*)(int, int, void *, int *, mpi_status_t *))mpi.iprobe)(
+          source, MPI_REDUCE_TAG, mpi_comm_world.ompi, &flag, &status);
+    } else {
+      ((int (*)(int, int, int, int *, mpi_status_t *))mpi.iprobe)(
+          source, MPI_REDUCE_TAG, mpi_comm_world.mpich, &flag, &status);
+    }
+    if (flag) {
+      return true;
+    }
+    nanosleep(&(struct timespec){0, 1000000}, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  } while (now.tv_sec - start.tv_sec < seconds);
+  return false;
+}
+
+/* Summary of the cancellations of a rank, sent to its parent in the
+ * reduction tree: this header, the functions sorted by name, then their
+ * names */
+typedef struct {
+  uint64_t histogram[_precision_end_][DOUBLE_PMAN_SIZE + 2];
+  /* cancellations in functions not tracked */
+  uint64_t overflow;
+  /* ranks merged in the summary */
+  uint64_t ranks;
+  uint64_t functions;
+  uint64_t names_size;
+} mpi_summary_t;
+
+typedef struct {
+  uint64_t count;
+  int32_t max;
+  /* offset of the name in the names */
+  uint32_t name;
+} mpi_summary_function_t;
+
+static inline mpi_summary_function_t *
+_mpi_summary_functions(const mpi_summary_t *s) {
+  return (mpi_summary_function_t *)(s + 1);
+}
+
+static inline char *_mpi_summary_names(const mpi_summary_t *s) {
+  return (char *)(_mpi_summary_functions(s) + s->functions);
+}
+
+static inline uint64_t _mpi_summary_size(const mpi_summary_t *s) {
+  return sizeof(mpi_summary_t) + s->functions * sizeof(mpi_summary_function_t) +
+         s->names_size;
+}
+
+static mpi_summary_t *_mpi_summary_new(const uint64_t functions,
+                                       const uint64_t names_size) {
+  mpi_summary_t *s = (mpi_summary_t *)_arena_alloc(
+      sizeof(mpi_summary_t) + functions * sizeof(mpi_summary_function_t) +
+      names_size);
+  *s = (mpi_summary_t){{{0}}, 0, 1, functions, names_size};
+  return s;
+}
+
+/* Returns the summary of the threads of the rank */
+static mpi_summary_t *_mpi_summary_local(void) {
+  function_table_t *table = _function_tables_merge();
+  /* the functions with cancellations, insertion sorted by name */
+  const function_entry_t **sorted = (const function_entry_t **)_arena_alloc(
+      FUNCTION_TABLE_SIZE * sizeof(function_entry_t *));
+  uint64_t n = 0, names_size = 0;
+  for (int i = 0; i < FUNCTION_TABLE_SIZE; i++) {
+    const function_entry_t *entry = &table->entries[i];
+    if (entry->function == NULL || entry->count == 0) {
+      continue;
+    }
+    uint64_t j = n++;
+    for (; j > 0 && interflop_strcmp(sorted[j - 1]->function->id,
+                                     entry->function->id) > 0;
+         j--) {
+      sorted[j] = sorted[j - 1];
+    }
+    sorted[j] = entry;
+    names_size += strlen(entry->function->id) + 1;
+  }
+
+  mpi_summary_t *s = _mpi_summary_new(n, names_size);
+  histogram_t histogram;
+  _histogram_reduce(&histogram);
+  for (int p = 0; p < _precision_end_; p++) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS[p]; i++) {
+      s->histogram[p][i] = histogram.counts[p][i];
+    }
+  }
+  s->overflow = table->overflow.count;
+  mpi_summary_function_t *functions = _mpi_summary_functions(s);
+  char *names = _mpi_summary_names(s);
+  uint32_t offset = 0;
+  for (uint64_t i = 0; i < n; i++) {
+    functions[i] = (mpi_summary_function_t){sorted[i]->count, sorted[i]->max,
+                                            offset};
+    interflop_sprintf(names + offset, "%s", sorted[i]->function->id);
+    offset += strlen(sorted[i]->function->id) + 1;
+  }
+  return s;
+}
+
+/* Returns the summary merging a and b, the functions of both are merged by
+ * name in a single pass */
+static mpi_summary_t *_mpi_summary_merge(const mpi_summary_t *a,
+                                         const mpi_summary_t *b) {
+  mpi_summary_t *m = _mpi_summary_new(a->functions + b->functions,
+                                      a->names_size + b->names_size);
+  for (int p = 0; p < _precision_end_; p++) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS[p]; i++) {
+      m->histogram[p][i] = a->histogram[p][i] + b->histogram[p][i];
+    }
+  }
+  m->overflow = a->overflow + b->overflow;
+  m->ranks = a->ranks + b->ranks;
+
+  const mpi_summary_function_t *fa = _mpi_summary_functions(a);
+  const mpi_summary_function_t *fb = _mpi_summary_functions(b);
+  const char *na = _mpi_summary_names(a), *nb = _mpi_summary_names(b);
+  mpi_summary_function_t *fm = _mpi_summary_functions(m);
+  char *nm = _mpi_summary_names(m);
+  uint64_t i = 0, j = 0, n = 0;
+  uint32_t offset = 0;
+  while (i < a->functions || j < b->functions) {
+    int order = (i == a->functions)   ? 1
+                : (j == b->functions) ? -1
+                                      : interflop_strcmp(na + fa[i].name,
+                                                         nb + fb[j].name);
+    const char *name = (order <= 0) ? na + fa[i].name : nb + fb[j].name;
+    mpi_summary_function_t f = (order <= 0) ? fa[i] : fb[j];
+    if (order == 0) {
+      f.count += fb[j].count;
+      f.max = (fb[j].max > f.max) ? fb[j].max : f.max;
+    }
+    i += (order <= 0);
+    j += (order >= 0);
+    f.name = offset;
+    fm[n++] = f;
+    interflop_sprintf(nm + offset, "%s", name);
+    offset += strlen(name) + 1;
+  }
+  /* the names are moved after the merged functions, which may be fewer */
+  m->functions = n;
+  m->names_size = offset;
+  memmove(_mpi_summary_names(m), nm, offset);
+  return m;
+}
+
+/* Writes the reports of the summary of all the ranks */
+static void _mpi_report(const cancellation_context_t *ctx,
+                        const mpi_summary_t *s, const int ranks) {
+  logger_info("interflop_cancellation: reports of %lu MPI ranks\n",
+              s->ranks);
+  if (s->ranks < (uint64_t)ranks) {
+    logger_warning("--mpi-reduce: %lu of the %d MPI ranks did not join the "
+                   "reduction, they write their own reports\n",
+                   ranks - s->ranks, ranks);
+  }
+  if (ctx->histogram_file != NULL) {
+    histogram_t total = {{{0}}, NULL};
+    for (int p = 0; p < _precision_end_; p++) {
+      for (int i = 0; i < HISTOGRAM_BUCKETS[p]; i++) {
+        total.counts[p][i] = s->histogram[p][i];
+      }
+    }
+    _histogram_write_total(ctx, &total);
+  }
+  if (ctx->top_functions != 0) {
+    const mpi_summary_function_t *functions = _mpi_summary_functions(s);
+    char *names = _mpi_summary_names(s);
+    interflop_function_info_t *infos =
+        (interflop_function_info_t *)_arena_alloc(
+            s->functions * sizeof(interflop_function_info_t));
+    function_entry_t *entries = (function_entry_t *)_arena_alloc(
+        s->functions * sizeof(function_entry_t));
+    for (uint64_t i = 0; i < s->functions; i++) {
+      infos[i] = (interflop_function_info_t){.id = names + functions[i].name};
+      entries[i] = (function_entry_t){&infos[i], functions[i].count,
+                                      functions[i].max, TOLERANCE_GLOBAL};
+    }
+    _function_report_entries(ctx, entries, s->functions, s->overflow);
+  }
+}
+
+/* Merges the summaries of all the ranks to rank 0, which reports them. A
+ * child sends the size of its summary and waits for the acknowledgment of
+ * its parent. Once it has acknowledged, the parent waits for whatever the
+ * child sends next: the summary, or a single byte if the child gave up
+ * waiting, which never follows an acknowledgment it received. Only the
+ * acknowledged summaries are sent, so a summary is reported exactly once: by
+ * rank 0, or by the rank that failed to pass it on. The other messages are
+ * small enough to complete without a matching receive */
+static void _mpi_reduce(void) {
+  int rank = 0, size = 1;
+  _mpi_comm_rank(mpi_comm_world, &rank);
+  _mpi_comm_size(mpi_comm_world, &size);
+  int levels = 0;
+  while ((1 << levels) < size) {
+    levels++;
+  }
+  mpi_summary_t *summary = _mpi_summary_local();
+  for (int step = 1, level = 0; step < size; step <<= 1, level++) {
+    if (rank & step) {
+      const int parent = rank - step;
+      const uint64_t bytes = _mpi_summary_size(summary);
+      _mpi_send(&bytes, sizeof(bytes), parent);
+      /* the parent may first wait for the subtrees of its other children */
+      if (_mpi_wait(parent, MPI_REDUCE_TIMEOUT * (levels + 1))) {
+        char ack = 0;
+        _mpi_recv(&ack, sizeof(ack), parent);
+        _mpi_send(summary, bytes, parent);
+        mpi_reported = true;
+        return;
+      }
+      const char withdrawn = 0;
+      _mpi_send(&withdrawn, sizeof(withdrawn), parent);
+      logger_warning("--mpi-reduce: rank %d did not collect the summary of "
+                     "rank %d\n",
+                     parent, rank);
+      /* the summaries collected from the children are only known here */
+      if (summary->ranks > 1) {
+        _mpi_report(mpi_context, summary, (int)summary->ranks);
+        mpi_reported = true;
+      }
+      return;
+    }
+    const int child = rank + step;
+    /* the subtree of the child waits level times for its own children */
+    if (child >= size || !_mpi_wait(child, MPI_REDUCE_TIMEOUT * (level + 1))) {
+      continue;
+    }
+    uint64_t bytes = 0;
+    _mpi_recv(&bytes, sizeof(bytes), child);
+    const char ack = 1;
+    _mpi_send(&ack, sizeof(ack), child);
+    /* zeroed, a withdrawal leaves the count of ranks to 0 */
+    mpi_summary_t *subtree = (mpi_summary_t *)_arena_alloc(bytes);
+    _mpi_recv(subtree, bytes, child);
+    if (subtree->ranks != 0) {
+      summary = _mpi_summary_merge(summary, subtree);
+    }
+  }
+  if (rank == 0) {
+    _mpi_report(mpi_context, summary, size);
+    mpi_reported = true;
+  }
+}
+
+/* Callbacks of the attribute of MPI_COMM_SELF, in both ABIs. The attribute
+ * is not copied, and is deleted by MPI_Finalize */
+static int _mpi_copy_ompi(_u_ void *comm, _u_ int keyval, _u_ void *extra,
+                          _u_ void *in, _u_ void *out, int *flag) {
+  *flag = 0;
+  return 0;
+}
+
+static int _mpi_copy_mpich(_u_ int comm, _u_ int keyval, _u_ void *extra,
+                           _u_ void *in, _u_ void *out, int *flag) {
+  *flag = 0;
+  return 0;
+}
+
+static int _mpi_delete_ompi(_u_ void *comm, _u_ int keyval, _u_ void *value,
+                            _u_ void *extra) {
+  _mpi_reduce();
+  return 0;
+}
+
+static int _mpi_delete_mpich(_u_ int comm, _u_ int keyval, _u_ void *value,
+                             _u_ void *extra) {
+  _mpi_reduce();
+  return 0;
+}
+
+/* Selects the ABI of the MPI library, if the program links one, and arms
+ * the hook of the reduction */
+static void _mpi_init(const cancellation_context_t *ctx) {
+  if (MPI_Initialized == NULL) {
+    logger_warning("--mpi-reduce: the program does not use MPI, the process "
+                   "reports on its own\n");
+    return;
+  }
+  mpi = (mpi_functions_t){MPI_Comm_rank,          MPI_Comm_size,
+                          MPI_Comm_create_keyval, MPI_Comm_set_attr,
+                          MPI_Send,               MPI_Recv,
+                          MPI_Iprobe};
+  mpi_ompi = ompi_mpi_comm_world != NULL;
+  if (mpi_ompi) {
+    mpi_comm_world.ompi = ompi_mpi_comm_world;
+    mpi_comm_self.ompi = ompi_mpi_comm_self;
+    mpi_byte.ompi = ompi_mpi_byte;
+  } else {
+    mpi_comm_world.mpich = MPICH_COMM_WORLD;
+    mpi_comm_self.mpich = MPICH_COMM_SELF;
+    mpi_byte.mpich = MPICH_BYTE;
+  }
+  mpi_context = ctx;
+  /* init runs on the main thread, the one that initializes MPI */
+  mpi_main_state = _get_thread_state();
+}
+
+/* Stops the polling of the main thread */
+static void _mpi_hook_done(void) {
+  __atomic_store_n(&mpi_main_state, NULL, __ATOMIC_RELAXED);
+  __atomic_store_n(&per_operation_state, mpi_per_operation_state,
+                   __ATOMIC_RELAXED);
+}
+
+/* Sets the attribute of MPI_COMM_SELF once MPI is initialized, on the main
+ * thread only, as MPI may not be called from the others. Once set, the
+ * checks stop looking at the per-thread state for it */
+static __attribute__((noinline)) void _mpi_hook(void) {
+  if (mpi_main_state == NULL) {
+    return;
+  }
+  int initialized = 0, finalized = 0;
+  MPI_Initialized(&initialized);
+  if (!initialized) {
+    return;
+  }
+  MPI_Finalized(&finalized);
+  if (finalized) {
+    logger_warning("--mpi-reduce: MPI was finalized before the backend "
+                   "could join the reduction, the rank reports on its own\n");
+    _mpi_hook_done();
+    return;
+  }
+  int keyval = 0;
+  if (mpi_ompi) {
+    ((int (*)(mpi_function_t, mpi_function_t, int *,
+              void *))mpi.comm_create_keyval)(
+        (mpi_function_t)_mpi_copy_ompi, (mpi_function_t)_mpi_delete_ompi,
+        &keyval, NULL);
+    ((int (*)(void *, int, void *))mpi.comm_set_attr)(mpi_comm_self.ompi,
+                                                      keyval, NULL);
+  } else {
+    ((int (*)(mpi_function_t, mpi_function_t, int *,
+              void *))mpi.comm_create_keyval)(
+        (mpi_function_t)_mpi_copy_mpich, (mpi_function_t)_mpi_delete_mpich,
+        &keyval, NULL);
+    ((int (*)(int, int, void *))mpi.comm_set_attr)(mpi_comm_self.mpich,
+                                                   keyval, NULL);
+  }
+  _mpi_hook_done();
+}
+
+/* Sets the attribute from the main thread, if it is not set yet */
+__attribute__((always_inline)) static inline void
+_mpi_poll(const thread_state_t *state) {
+  if (__builtin_expect(
+          state == __atomic_load_n(&mpi_main_state, __ATOMIC_RELAXED), 0)) {
+    _mpi_hook();
+  }
+}
+
+#undef _u_
+
+/* per-thread counters of the precision losses outside of additions and
+ * subtractions, enabled with --precision-loss */
+typedef struct precision_loss {
+  /* comparisons of nearly-equal operands, whose difference cancels by at
+   * least the tolerance: a noise of the magnitude of the cancelled bits could
+   * flip their ordering */
+  uint64_t unstable_cmp[_precision_end_];
+  /* largest cancellation of the difference of the compared operands */
+  int32_t unstable_cmp_max[_precision_end_];
+  /* double to float casts that round, and the largest number of
+   * significant bits discarded by one of them */
+  uint64_t cast_inexact;
+  int32_t cast_max_lost_bits;
+  /* finite doubles cast to infinity, and non-zero doubles cast to zero or to
+   * an inexact subnormal */
+  uint64_t cast_overflow;
+  uint64_t cast_underflow;
+  struct precision_loss *next;
+} precision_loss_t;
+
+/* list of the counters of all threads, reduced at finalize */
+static precision_loss_t *precision_losses = NULL;
+
+static precision_loss_t *_new_precision_loss(void) {
+  precision_loss_t *loss =
+      (precision_loss_t *)_arena_alloc(sizeof(precision_loss_t));
+  *loss = (precision_loss_t){{0}, {0}, 0, 0, 0, 0, NULL};
+  list_push(&precision_losses, loss);
+  return loss;
+}
+
+static inline precision_loss_t *_get_precision_loss(void) {
+  thread_state_t *state = _get_thread_state();
+  if (__builtin_expect(state->precision_loss == NULL, 0)) {
+    state->precision_loss = _new_precision_loss();
+  }
+  return state->precision_loss;
+}
+
+/* The counters are only written by their thread, see _histogram_add */
+static inline void _precision_loss_add(uint64_t *count) {
+  __atomic_store_n(count, __atomic_load_n(count, __ATOMIC_RELAXED) + 1,
+                   __ATOMIC_RELAXED);
+}
+
+static inline void _precision_loss_max(int32_t *max, const int32_t value) {
+  if (value > __atomic_load_n(max, __ATOMIC_RELAXED)) {
+    __atomic_store_n(max, value, __ATOMIC_RELAXED);
+  }
+}
+
+/* Reduces the counters of all threads and reports them */
+static void _precision_loss_report(void) {
+  precision_loss_t total = {{0}, {0}, 0, 0, 0, 0, NULL};
+  precision_loss_t *loss =
+      __atomic_load_n(&precision_losses, __ATOMIC_ACQUIRE);
+  for (; loss != NULL; loss = loss->next) {
+    for (int p = 0; p < _precision_end_; p++) {
+      total.unstable_cmp[p] +=
+          __atomic_load_n(&loss->unstable_cmp[p], __ATOMIC_RELAXED);
+      _precision_loss_max(&total.unstable_cmp_max[p],
+                          __atomic_load_n(&loss->unstable_cmp_max[p],
+                                          __ATOMIC_RELAXED));
+    }
+    total.cast_inexact +=
+        __atomic_load_n(&loss->cast_inexact, __ATOMIC_RELAXED);
+    _precision_loss_max(
+        &total.cast_max_lost_bits,
+        __atomic_load_n(&loss->cast_max_lost_bits, __ATOMIC_RELAXED));
+    total.cast_overflow +=
+        __atomic_load_n(&loss->cast_overflow, __ATOMIC_RELAXED);
+    total.cast_underflow +=
+        __atomic_load_n(&loss->cast_underflow, __ATOMIC_RELAXED);
+  }
+
+  logger_info("precision losses:\n");
+  for (int p = 0; p < _precision_end_; p++) {
+    logger_info("  %s comparisons of nearly-equal operands: %lu, max "
+                "cancellation %d\n",
+                PRECISION_STR[p], total.unstable_cmp[p],
+                total.unstable_cmp_max[p]);
+  }
+  logger_info("  inexact double to float casts: %lu, max %d significant "
+              "bits discarded\n",
+              total.cast_inexact, total.cast_max_lost_bits);
+  logger_info("  double to float casts with overflow: %lu, with underflow: "
+              "%lu\n",
+              total.cast_overflow, total.cast_underflow);
+}
+
+/* Event trace: with --trace, each cancellation larger than the tolerance is
+ * appended as a fixed-size binary record to the trace file, see
+ * interflop_cancellation_trace.h. Each thread claims its own chunks of the
+ * file with an atomic counter and maps them, so that recording an event is
+ * a store through the mapping, with no lock and no formatting. The file is
+ * grown with posix_fallocate, which never shrinks it when chunks are claimed
+ * concurrently, and fills the unused records with zeros. */
+
+/* Number of records of a chunk, 1 MiB chunks */
+#define TRACE_CHUNK_RECORDS (1 << 16)
+#define TRACE_CHUNK_SIZE                                                       \
+  (TRACE_CHUNK_RECORDS * sizeof(cancellation_trace_record_t))
+
+/* descriptor of the trace file, -1 if the trace is disabled */
+static int trace_fd = -1;
+/* number of chunks claimed by the threads */
+static uint64_t trace_chunks = 0;
+
+/* Exponent of a cancelling term, as written in the trace */
+#define TRACE_EXPONENT(X)                                                      \
+  ((X) == 0 ? CANCELLATION_TRACE_EXPONENT_ZERO                                 \
+            : _Generic((X),                                                    \
+                  float: _exponent_binary32,                                   \
+                  double: _exponent_binary64)(X))
+
+/* Identifier of a function in the trace, a hash of its info that does not
+ * depend on the per-thread tables. 0 is kept for no function */
+static inline uint32_t _trace_function_id(const interflop_function_info_t *f) {
+  const uint32_t id =
+      (uint32_t)(((uintptr_t)f >> 4) * 0x9E3779B97F4A7C15ULL >> 32);
+  return (id == 0) ? 1 : id;
+}
+
+/* Creates the trace file and writes its header */
+static void _trace_open(const cancellation_context_t *ctx) {
+  trace_fd = open(ctx->trace_file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (trace_fd < 0) {
+    logger_error("cannot open trace file %s: %s\n", ctx->trace_file,
+                 interflop_strerror(errno));
+  }
+  char header[CANCELLATION_TRACE_HEADER_SIZE] = {0};
+  cancellation_trace_header_t *h = (cancellation_trace_header_t *)header;
+  memcpy(h->magic, CANCELLATION_TRACE_MAGIC, sizeof(h->magic));
+  h->version = CANCELLATION_TRACE_VERSION;
+  h->record_size = sizeof(cancellation_trace_record_t);
+  h->chunk_records = TRACE_CHUNK_RECORDS;
+  if (write(trace_fd, header, sizeof(header)) != sizeof(header)) {
+    logger_error("cannot write trace file %s: %s\n", ctx->trace_file,
+                 interflop_strerror(errno));
+  }
+}
+
+/* Unmaps the chunk of the thread, if any. Its records are kept in the file */
+static void _trace_close_chunk(thread_state_t *state) {
+  if (state->trace_end != NULL) {
+    munmap(state->trace_end - TRACE_CHUNK_RECORDS, TRACE_CHUNK_SIZE);
+  }
+}
+
+/* Unmaps the full chunk of the thread, if any, and maps a new one */
+static __attribute__((noinline)) void _trace_new_chunk(thread_state_t *state) {
+  if (state->trace_end != NULL) {
+    _trace_close_chunk(state);
+  } else {
+    state->trace_tid = interflop_gettid();
+  }
+  const uint64_t chunk =
+      __atomic_fetch_add(&trace_chunks, 1, __ATOMIC_RELAXED);
+  const off_t offset =
+      CANCELLATION_TRACE_HEADER_SIZE + chunk * TRACE_CHUNK_SIZE;
+  const int error = posix_fallocate(trace_fd, offset, TRACE_CHUNK_SIZE);
+  if (error != 0) {
+    logger_error("cannot grow the trace file: %s\n", interflop_strerror(error));
+  }
+  void *records = mmap(NULL, TRACE_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, trace_fd, offset);
+  if (records == MAP_FAILED) {
+    logger_error("cannot map the trace file: %s\n", interflop_strerror(errno));
+  }
+  state->trace_cursor = (cancellation_trace_record_t *)records;
+  state->trace_end = state->trace_cursor + TRACE_CHUNK_RECORDS;
+}
+
+/* Appends a record to the trace chunk of the thread of state */
+static void _trace_add(thread_state_t *state, const cancellation_trace_op_t op,
+                       const int precision, const int cancellation,
+                       const int32_t e_x, const int32_t e_y) {
+  if (__builtin_expect(state->trace_cursor == state->trace_end, 0)) {
+    _trace_new_chunk(state);
+  }
+  const function_entry_t *entry = state->function_entry;
+  *state->trace_cursor++ = (cancellation_trace_record_t){
+      .tid = state->trace_tid,
+      .function = (entry != NULL && entry->function != NULL)
+                      ? _trace_function_id(entry->function)
+                      : 0,
+      .e_x = e_x,
+      .e_y = e_y,
+      .op = op,
+      .precision = precision,
+      .size = cancellation};
+}
+
+/* Writes the names of the functions seen by the threads to the .functions
+ * file of the trace */
+static void _trace_write_functions(const cancellation_context_t *ctx) {
+  char *path = (char *)_arena_alloc(strlen(ctx->trace_file) +
+                                        sizeof(".functions"));
+  interflop_sprintf(path, "%s.functions", ctx->trace_file);
+  int error = 0;
+  File *stream = interflop_fopen(path, "w", &error);
+  if (stream == NULL) {
+    logger_warning("cannot open trace functions file %s: %s\n", path,
+                   interflop_strerror(error));
+    return;
+  }
+  const function_table_t *total = _function_tables_merge();
+  interflop_fprintf(stream, "id,name\n");
+  for (int i = 0; i < FUNCTION_TABLE_SIZE; i++) {
+    const interflop_function_info_t *function = total->entries[i].function;
+    if (function != NULL) {
+      interflop_fprintf(stream, "%u,%s\n", _trace_function_id(function),
+                        function->id);
+    }
+  }
+  interflop_fclose(stream, &error);
+}
+
+/* Live counters: with --stats, the counters of each thread are published in
+ * a POSIX shared-memory segment that an external reader can attach to while
+ * the process runs, see interflop_cancellation_stats.h. A thread claims its
+ * slot with an atomic counter on its first operation, then only updates it
+ * with relaxed stores: the hot path makes no syscall and takes no lock. */
+
+/* shared-memory segment, NULL if the counters are not published */
+static cancellation_stats_t *stats_segment = NULL;
+/* slot shared by the threads beyond CANCELLATION_STATS_THREADS, never read
+ */
+static cancellation_stats_thread_t stats_discarded;
+
+/* Creates and maps the shared-memory segment of the process */
+static void _stats_open(void) {
+  char name[64];
+  interflop_sprintf(name, CANCELLATION_STATS_NAME_FORMAT, getpid());
+  const int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || ftruncate(fd, sizeof(cancellation_stats_t)) != 0) {
+    logger_error("cannot create the shared-memory segment %s: %s\n", name,
+                 interflop_strerror(errno));
+  }
+  void *segment = mmap(NULL, sizeof(cancellation_stats_t),
+                       PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (segment == MAP_FAILED) {
+    logger_error("cannot map the shared-memory segment %s: %s\n", name,
+                 interflop_strerror(errno));
+  }
+  stats_segment = (cancellation_stats_t *)segment;
+  stats_segment->version = CANCELLATION_STATS_VERSION;
+  stats_segment->max_threads = CANCELLATION_STATS_THREADS;
+  /* published last, a reader checks it to know that the segment is ready */
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(stats_segment->magic, CANCELLATION_STATS_MAGIC,
+         sizeof(stats_segment->magic));
+  logger_info("interflop_cancellation: live counters in shared memory %s\n",
+              name);
+}
+
+/* Removes the segment, the process keeps its mapping */
+static void _stats_close(void) {
+  char name[64];
+  interflop_sprintf(name, CANCELLATION_STATS_NAME_FORMAT, getpid());
+  shm_unlink(name);
+}
+
+static __attribute__((noinline)) cancellation_stats_thread_t *
+_stats_claim(thread_state_t *state) {
+  const uint64_t i =
+      __atomic_fetch_add(&stats_segment->threads, 1, __ATOMIC_RELAXED);
+  if (i >= CANCELLATION_STATS_THREADS) {
+    state->stats = &stats_discarded;
+  } else {
+    state->stats = &stats_segment->thread[i];
+    __atomic_store_n(&state->stats->tid, interflop_gettid(), __ATOMIC_RELAXED);
+  }
+  return state->stats;
+}
+
+/* The counters are only written by their thread, see _histogram_add */
+static inline void _stats_add(uint64_t *count, const uint64_t n) {
+  __atomic_store_n(count, __atomic_load_n(count, __ATOMIC_RELAXED) + n,
+                   __ATOMIC_RELAXED);
+}
+
+static inline cancellation_stats_thread_t *
+_stats_get(thread_state_t *state) {
+  return __builtin_expect(state->stats == NULL, 0) ? _stats_claim(state)
+                                                   : state->stats;
+}
+
+/* Counts n operations of the calling thread */
+static inline void _stats_add_operations(thread_state_t *state,
+                                         const uint64_t n) {
+  if (__builtin_expect(stats_segment != NULL, 0)) {
+    _stats_add(&_stats_get(state)->operations, n);
+  }
+}
+
+static inline void _stats_add_noises(thread_state_t *state, const uint64_t n) {
+  _profile_noises(n);
+  if (stats_segment != NULL) {
+    _stats_add(&_stats_get(state)->noises, n);
+  }
+}
+
+static inline void _stats_add_event(thread_state_t *state,
+                                    const int cancellation) {
+  if (stats_segment != NULL) {
+    const int last = CANCELLATION_STATS_SIZES - 1;
+    _stats_add(
+        &_stats_get(state)->events[cancellation < last ? cancellation : last],
+        1);
+  }
+}
+
+/* Records a cancellation larger than the tolerance */
+static inline void _record_cancellation(thread_state_t *state,
+                                        const int cancellation,
+                                        const cancellation_context_t *ctx) {
+  if (ctx->warning) {
+    _report_cancellation(state, cancellation, ctx);
+  }
+  function_entry_t *entry = state->function_entry;
+  if (entry != NULL) {
+    _function_add(entry, cancellation);
+  }
+  _stats_add_event(state, cancellation);
+}
+
+/* Tolerance of the context, set by cancellation_set_tolerance */
+static inline int _context_tolerance(const cancellation_context_t *ctx) {
+  return __atomic_load_n(&ctx->tolerance, __ATOMIC_RELAXED);
+}
+
+/* Tolerance of the function executed by the thread of state */
+static inline int _thread_tolerance(const thread_state_t *state,
+                                    const cancellation_context_t *ctx) {
+  if (__builtin_expect(function_tolerances == NULL, 1)) {
+    return _context_tolerance(ctx);
+  }
+  return (state->function_entry != NULL &&
+          state->function_tolerance != TOLERANCE_GLOBAL)
+             ? state->function_tolerance
+             : _context_tolerance(ctx);
+}
+
+/* Tolerance of the function executed by the calling thread */
+static inline int _tolerance(const cancellation_context_t *ctx) {
+  if (__builtin_expect(function_tolerances == NULL, 1)) {
+    return _context_tolerance(ctx);
+  }
+  return _thread_tolerance(_get_thread_state(), ctx);
+}
+
+/* Bound of the thresholds, above the largest cancellation, FMAs of binary64
+ * included. The excluded functions and the large tolerances are clamped to
+ * it so that the differences of _no_cancellation do not overflow */
+#define THRESHOLD_MAX (4 * DOUBLE_EXP_MAX)
+
+/* Smallest cancellation size that needs to go through the slow path */
+static inline int _lane_threshold(const cancellation_context_t *ctx) {
+  return min(_tolerance(ctx), THRESHOLD_MAX);
+}
+
+/* Threshold of the lane masks of the packed and array operations, 0 with a
+ * histogram so that their lane loops count every lane */
+static inline int _mask_threshold(const cancellation_context_t *ctx) {
+  return (ctx->histogram_file != NULL) ? 0 : _lane_threshold(ctx);
+}
+
+/* The exponents are extracted with shifts on the integer representation,
+ * rather than through the bitfields, which the compilers do not vectorize */
+static inline int32_t _biased_exponent_binary32(const float x) {
+  binary32 b32 = {.f32 = x};
+  return (b32.u32 >> FLOAT_PMAN_SIZE) & 0xFF;
+}
+
+static inline int32_t _biased_exponent_binary64(const double x) {
+  binary64 b64 = {.f64 = x};
+  return (b64.u64 >> DOUBLE_PMAN_SIZE) & 0x7FF;
+}
+
+#define BIASED_EXPONENT(X)                                                     \
+  _Generic((X),                                                                \
+      float: _biased_exponent_binary32,                                        \
+      double: _biased_exponent_binary64)(X)
+
+/* Sampling: with a sample period or a sample rate, only a subset of the
+ * additions, subtractions and FMAs of each thread go through the cancellation
+ * test. sample_countdown is the number of operations of the thread left
+ * before the next checked one, it is reloaded with the period, or with a
+ * geometric draw of mean 1 / rate. */
+
+/* true if the context checks only a subset of the operations, set at init */
+static bool sampling = false;
+/* log(1 - sample_rate) for the geometric draws, set at init */
+static double sample_log_complement = 0;
+
+/* Natural logarithm of x > 0, precise enough for the geometric draws and
+ * without depending on libm. x = m * 2^e with m in [1, 2), and
+ * log(m) = 2 * atanh((m - 1) / (m + 1)) */
+static double _log_binary64(const double x) {
+  binary64 b64 = {.f64 = x};
+  const int32_t e = _biased_exponent_binary64(x) - DOUBLE_EXP_COMP;
+  b64.ieee.exponent = DOUBLE_EXP_COMP;
+  const double s = (b64.f64 - 1) / (b64.f64 + 1);
+  const double s2 = s * s;
+  const double atanh =
+      s * (1 + s2 * (1.0 / 3 + s2 * (1.0 / 5 + s2 * (1.0 / 7 + s2 / 9))));
+  return e * 0x1.62e42fefa39efp-1 + 2 * atanh;
+}
+
+static void _sample_init(const cancellation_context_t *ctx) {
+  sampling = ctx->sample_rate < 1 || ctx->sample_period > 1;
+  if (ctx->sample_rate < 1) {
+    sample_log_complement = _log_binary64(1 - ctx->sample_rate);
+  }
+}
+
+/* Returns the number of operations until the next checked one */
+static uint64_t _sample_next(const cancellation_context_t *ctx) {
+  if (ctx->sample_rate < 1) {
+    /* u in (0, 1] */
+    const double u = 0.5 - _get_rand(ctx);
+    return 1 + (uint64_t)(_log_binary64(u) / sample_log_complement);
+  }
+  return ctx->sample_period;
+}
+
+/* Returns true if the current operation is not sampled. The countdown is only
+ * accessed by its thread */
+static inline bool _sample_skip(thread_state_t *state,
+                                const cancellation_context_t *ctx) {
+  if (__builtin_expect(state->sample_countdown > 1, 1)) {
+    state->sample_countdown--;
+    return true;
+  }
+  state->sample_countdown = _sample_next(ctx);
+  return false;
+}
+
+/* Branch-free test of the fast paths: true if an operation whose largest
+ * terms have the biased exponents e_x and e_y cancels less than threshold
+ * bits, and its result of biased exponent e_z is neither zero nor subnormal.
+ * Both differences e_x - e_z - threshold and e_y - e_z - threshold are then
+ * negative, as is -e_z, so that the sign of their conjunction decides */
+static inline bool _no_cancellation(const int32_t e_x, const int32_t e_y,
+                                    const int32_t e_z,
+                                    const int32_t threshold) {
+  return ((e_x - e_z - threshold) & (e_y - e_z - threshold) & -e_z) < 0;
+}
+
+/* Counts in the histogram the cancellation e_x - e_z of a normal result of
+ * biased exponent e_z, where e_x is the biased exponent of the largest terms,
+ * and returns true if it stays below threshold. Otherwise, or if the result
+ * is zero, subnormal, infinite or NaN, the operation is left to the slow
+ * path, which counts it with the exact exponents */
+static inline bool _histogram_inline(const precision_t precision,
+                                     const int32_t e_x, const int32_t e_z,
+                                     const int32_t e_inf,
+                                     const int32_t threshold) {
+  const int32_t cancellation = e_x - e_z;
+  if (e_z == 0 || e_z == e_inf || cancellation >= threshold) {
+    return false;
+  }
+  if (cancellation >= 0) {
+    thread_state_t *state = _get_thread_state();
+    if (!state->checking_disabled) {
+      _histogram_add(state, precision, cancellation);
+    }
+  }
+  return true;
+}
+
+/* Unbiased exponents of non-zero numbers, subnormals included */
+static inline int32_t _exponent_binary32(const float x) {
+  binary32 b32 = {.f32 = x};
+  const int32_t e = _biased_exponent_binary32(x);
+  if (__builtin_expect(e == 0, 0)) {
+    /* subnormal, the exponent is given by the leading bit of the mantissa */
+    const uint32_t mantissa = b32.u32 & ((1U << FLOAT_PMAN_SIZE) - 1);
+    return -FLOAT_EXP_COMP - FLOAT_PMAN_SIZE + 1 +
+           (31 - __builtin_clz(mantissa));
+  }
+  return e - FLOAT_EXP_COMP;
+}
+
+static inline int32_t _exponent_binary64(const double x) {
+  binary64 b64 = {.f64 = x};
+  const int32_t e = _biased_exponent_binary64(x);
+  if (__builtin_expect(e == 0, 0)) {
+    const uint64_t mantissa = b64.u64 & ((1ULL << DOUBLE_PMAN_SIZE) - 1);
+    return -DOUBLE_EXP_COMP - DOUBLE_PMAN_SIZE + 1 +
+           (63 - __builtin_clzll(mantissa));
+  }
+  return e - DOUBLE_EXP_COMP;
+}
+
+/* per-thread spread of the perturbed results of the cancellations, by
+ * precision and size, enabled with --samples */
+typedef struct spread {
+  uint64_t events[_precision_end_][DOUBLE_PMAN_SIZE + 2];
+  /* sum and minimum of the significant bits estimated from the samples */
+  double bits_sum[_precision_end_][DOUBLE_PMAN_SIZE + 2];
+  double bits_min[_precision_end_][DOUBLE_PMAN_SIZE + 2];
+  struct spread *next;
+} spread_t;
+
+/* list of the spreads of all threads, reduced at finalize */
+static spread_t *spreads = NULL;
+
+static spread_t *_new_spread(void) {
+  spread_t *s = (spread_t *)_arena_alloc(sizeof(spread_t));
+  *s = (spread_t){{{0}}, {{0}}, {{0}}, NULL};
+  list_push(&spreads, s);
+  return s;
+}
+
+/* The accumulators are only written by their thread, see _histogram_add */
+static void _spread_add(const precision_t precision, const int cancellation,
+                        const double bits) {
+  thread_state_t *state = _get_thread_state();
+  if (__builtin_expect(state->spread == NULL, 0)) {
+    state->spread = _new_spread();
+  }
+  const int last = HISTOGRAM_BUCKETS[precision] - 1;
+  const int i = cancellation < last ? cancellation : last;
+  spread_t *s = state->spread;
+  uint64_t *events = &s->events[precision][i];
+  const uint64_t n = __atomic_load_n(events, __ATOMIC_RELAXED);
+  double sum, min;
+  __atomic_load(&s->bits_sum[precision][i], &sum, __ATOMIC_RELAXED);
+  __atomic_load(&s->bits_min[precision][i], &min, __ATOMIC_RELAXED);
+  sum += bits;
+  min = (n == 0 || bits < min) ? bits : min;
+  __atomic_store(&s->bits_sum[precision][i], &sum, __ATOMIC_RELAXED);
+  __atomic_store(&s->bits_min[precision][i], &min, __ATOMIC_RELAXED);
+  __atomic_store_n(events, n + 1, __ATOMIC_RELAXED);
+}
+
+/* Reduces the spreads of all threads and reports them */
+static void _spread_report(const cancellation_context_t *ctx) {
+  spread_t total = {{{0}}, {{0}}, {{0}}, NULL};
+  spread_t *s = __atomic_load_n(&spreads, __ATOMIC_ACQUIRE);
+  for (; s != NULL; s = s->next) {
+    for (int p = 0; p < _precision_end_; p++) {
+      for (int i = 0; i < HISTOGRAM_BUCKETS[p]; i++) {
+        const uint64_t n = __atomic_load_n(&s->events[p][i], __ATOMIC_RELAXED);
+        if (n == 0) {
+          continue;
+        }
+        double sum, min;
+        __atomic_load(&s->bits_sum[p][i], &sum, __ATOMIC_RELAXED);
+        __atomic_load(&s->bits_min[p][i], &min, __ATOMIC_RELAXED);
+        if (total.events[p][i] == 0 || min < total.bits_min[p][i]) {
+          total.bits_min[p][i] = min;
+        }
+        total.events[p][i] += n;
+        total.bits_sum[p][i] += sum;
+      }
+    }
+  }
+
+  logger_info("spread of %d perturbed results per cancellation:\n",
+              ctx->samples);
+  for (int p = 0; p < _precision_end_; p++) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS[p]; i++) {
+      if (total.events[p][i] == 0) {
+        continue;
+      }
+      logger_info("  %s size %s%d: %lu cancellations, %.1f significant bits "
+                  "on average, %.1f at least\n",
+                  PRECISION_STR[p], (i == HISTOGRAM_BUCKETS[p] - 1) ? ">" : "",
+                  (i == HISTOGRAM_BUCKETS[p] - 1) ? i - 1 : i,
+                  total.events[p][i], total.bits_sum[p][i] / total.events[p][i],
+                  total.bits_min[p][i]);
+    }
+  }
+}
+
+/* per-thread counters of the cancellations above the tolerance whose result
+ * is zero or subnormal, by precision */
+typedef struct underflow {
+  /* total cancellations, whose result is zero */
+  uint64_t zero[_precision_end_];
+  uint64_t subnormal[_precision_end_];
+  /* noises of these results below half of the smallest subnormal, which
+   * round to zero and leave the result unperturbed */
+  uint64_t vanished[_precision_end_];
+  struct underflow *next;
+} underflow_t;
+
+/* list of the counters of all threads, reduced at finalize */
+static underflow_t *underflows = NULL;
+
+static underflow_t *_new_underflow(void) {
+  underflow_t *u = (underflow_t *)_arena_alloc(sizeof(underflow_t));
+  *u = (underflow_t){{0}, {0}, {0}, NULL};
+  list_push(&underflows, u);
+  return u;
+}
+
+/* The counters are only written by their thread, see _histogram_add. They
+ * are counted from the slow paths, which are cold and optimized for size:
+ * the counting is forced inline, where it costs less than the calls */
+__attribute__((always_inline)) static inline void
+_underflow_count(uint64_t *count) {
+  __atomic_store_n(count, __atomic_load_n(count, __ATOMIC_RELAXED) + 1,
+                   __ATOMIC_RELAXED);
+}
+
+__attribute__((always_inline)) static inline void
+_underflow_add(thread_state_t *state, const precision_t precision,
+               const bool zero, const bool vanished) {
+  if (__builtin_expect(state->underflow == NULL, 0)) {
+    state->underflow = _new_underflow();
+  }
+  underflow_t *u = state->underflow;
+  _underflow_count(zero ? &u->zero[precision] : &u->subnormal[precision]);
+  if (vanished) {
+    _underflow_count(&u->vanished[precision]);
+  }
+}
+
+/* Reduces the counters of all threads and reports them */
+static void _underflow_report(void) {
+  underflow_t total = {{0}, {0}, {0}, NULL};
+  underflow_t *u = __atomic_load_n(&underflows, __ATOMIC_ACQUIRE);
+  for (; u != NULL; u = u->next) {
+    for (int p = 0; p < _precision_end_; p++) {
+      total.zero[p] += __atomic_load_n(&u->zero[p], __ATOMIC_RELAXED);
+      total.subnormal[p] +=
+          __atomic_load_n(&u->subnormal[p], __ATOMIC_RELAXED);
+      total.vanished[p] += __atomic_load_n(&u->vanished[p], __ATOMIC_RELAXED);
+    }
+  }
+
+  logger_info("cancellations with a zero or subnormal result:\n");
+  for (int p = 0; p < _precision_end_; p++) {
+    if (total.zero[p] == 0 && total.subnormal[p] == 0) {
+      continue;
+    }
+    logger_info("  %s: %lu total cancellations, %lu subnormal results, %lu "
+                "noises rounded to zero\n",
+                PRECISION_STR[p], total.zero[p], total.subnormal[p],
+                total.vanished[p]);
+  }
+}
+
+/* Defines the noise models of binaryBITS, see cancellation_noise_t:
+ *
+ * _perturb_MODEL_binaryBITS(res, e_n, ctx) perturbs the result *res of a
+ * cancellation by the noise of exponent e_n of the model. init selects the
+ * one of --noise in perturb_binaryBITS, so that the slow paths make a single
+ * indirect call and never branch on the model.
+ *
+ * _noise_fill_binaryBITS(rand, n, ctx) draws the n random factors of the
+ * noises of the uniform and sign models in one step, for the multi-sample
+ * mode and the array operations, which scale them themselves. */
+#define define_perturb(BITS, TYPE, UINT, PMAN_SIZE, EXP_COMP)                  \
+  typedef void (*perturb_binary##BITS##_t)(TYPE * res, const int32_t e_n,      \
+                                           const cancellation_context_t *ctx); \
+                                                                               \
+  static void _perturb_uniform_binary##BITS(                                   \
+      TYPE *res, const int32_t e_n, const cancellation_context_t *ctx) {       \
+    *res = _noise_binary##BITS(*res, e_n, ctx);                                \
+  }                                                                            \
+                                                                               \
+  /* +/- 0.5 from a random bit, set as the sign bit: a random sign would be    \
+   * mispredicted by a branch half of the time */                              \
+  static inline TYPE _rand_sign_binary##BITS(                                  \
+      const cancellation_context_t *ctx) {                                     \
+    binary##BITS b = {.f##BITS = 0.5};                                         \
+    b.u##BITS |= (UINT)_get_rand_sign(ctx) << (BITS - 1);                      \
+    return b.f##BITS;                                                          \
+  }                                                                            \
+                                                                               \
+  static void _perturb_sign_binary##BITS(TYPE *res, const int32_t e_n,         \
+                                         const cancellation_context_t *ctx) {  \
+    *res = _add_noise_binary##BITS(*res, _rand_sign_binary##BITS(ctx), e_n);   \
+  }                                                                            \
+                                                                               \
+  static void _perturb_truncate_binary##BITS(                                  \
+      TYPE *res, const int32_t e_n, const cancellation_context_t *ctx) {       \
+    (void)ctx;                                                                 \
+    const int32_t biased = _biased_exponent_binary##BITS(*res);                \
+    /* bits of the significand of weight below 2^e_n, the weight of its last   \
+     * bit is the one of the normal exponent e_z, or of the subnormals */      \
+    const int32_t cleared = e_n - (max(biased, 1) - EXP_COMP - PMAN_SIZE);     \
+    if (cleared <= 0) {                                                        \
+      return;                                                                  \
+    }                                                                          \
+    binary##BITS b = {.f##BITS = *res};                                        \
+    if (cleared > PMAN_SIZE) {                                                 \
+      /* |*res| < 2^e_n, only the sign is kept */                              \
+      b.u##BITS &= (UINT)1 << (BITS - 1);                                      \
+    } else {                                                                   \
+      b.u##BITS &= ~(((UINT)1 << cleared) - 1);                                \
+    }                                                                          \
+    *res = b.f##BITS;                                                          \
+  }                                                                            \
+                                                                               \
+  /* indexed by cancellation_noise_t */                                        \
+  static const perturb_binary##BITS##_t PERTURB_BINARY##BITS[] = {             \
+      _perturb_uniform_binary##BITS, _perturb_sign_binary##BITS,               \
+      _perturb_truncate_binary##BITS};                                         \
+                                                                               \
+  static perturb_binary##BITS##_t perturb_binary##BITS =                       \
+      _perturb_uniform_binary##BITS;                                           \
+                                                                               \
+  static void _noise_fill_binary##BITS(TYPE *rand, const int n,                \
+                                       const cancellation_context_t *ctx) {    \
+    if (ctx->noise == cancellation_noise_sign) {                               \
+      for (int i = 0; i < n; i++) {                                            \
+        rand[i] = _rand_sign_binary##BITS(ctx);                                \
+      }                                                                        \
+      return;                                                                  \
+    }                                                                          \
+    _rand_fill_binary##BITS(rand, n, ctx);                                     \
+  }
+
+define_perturb(32, float, uint32_t, FLOAT_PMAN_SIZE, FLOAT_EXP_COMP);
+define_perturb(64, double, uint64_t, DOUBLE_PMAN_SIZE, DOUBLE_EXP_COMP);
+
+/* Defines the multi-sample perturbation of binaryBITS:
+ *
+ * _multi_sample_binaryBITS(cancellation, e_n, res, ctx) computes
+ * ctx->samples perturbations of *res by noises of exponent e_n, keeps the
+ * first one in *res and records the number of significant bits of the
+ * samples, -log2 of their standard deviation relative to their mean, capped
+ * to the precision. The random numbers are drawn in one block, and the
+ * samples are computed in loops with no dependency between them */
+#define define_multi_sample(BITS, TYPE, PMAN_SIZE)                             \
+  __attribute__((noinline)) static void _multi_sample_binary##BITS(            \
+      const int cancellation, const int32_t e_n, TYPE *res,                    \
+      const cancellation_context_t *ctx) {                                     \
+    const int k = ctx->samples;                                                \
+    TYPE rand[CANCELLATION_SAMPLES_MAX];                                       \
+    TYPE z[CANCELLATION_SAMPLES_MAX];                                          \
+    _noise_fill_binary##BITS(rand, k, ctx);                                    \
+    for (int i = 0; i < k; i++) {                                              \
+      z[i] = _add_noise_binary##BITS(*res, rand[i], e_n);                      \
+    }                                                                          \
+    double mean = 0;                                                           \
+    for (int i = 0; i < k; i++) {                                              \
+      mean += z[i];                                                            \
+    }                                                                          \
+    mean /= k;                                                                 \
+    double bits = 0;                                                           \
+    if (mean != 0) {                                                           \
+      /* variance relative to the square of the mean, which neither            \
+       * overflows nor underflows */                                           \
+      double var = 0;                                                          \
+      for (int i = 0; i < k; i++) {                                            \
+        const double d = (z[i] - mean) / mean;                                 \
+        var += d * d;                                                          \
+      }                                                                        \
+      var /= k - 1;                                                            \
+      bits = (var == 0) ? PMAN_SIZE + 1                                        \
+                        : -0.5 * _log_binary64(var) * 0x1.71547652b82fep0;     \
+      bits = (bits < 0) ? 0 : (bits > PMAN_SIZE + 1) ? PMAN_SIZE + 1 : bits;   \
+    }                                                                          \
+    _spread_add(precision_binary##BITS, cancellation, bits);                   \
+    *res = z[0];                                                               \
+  }
+
+define_multi_sample(32, float, FLOAT_PMAN_SIZE);
+define_multi_sample(64, double, DOUBLE_PMAN_SIZE);
+
+/* Defines the cancellation test of binaryBITS:
+ *
+ * _cancellation_size_binaryBITS(a, b, z, &e_z) returns the size of the
+ * cancellation of z = a +/- b, the difference between the max of the
+ * exponents of both operands and the exponent e_z of the result, or -1 if
+ * the operation is not a cancellation. A zero result from non-zero operands
+ * is a total cancellation, of the size of the significand plus one, and e_z
+ * is the exponent of the first bit past the significand. Subnormals are
+ * measured at their exact exponents.
+ *
+ * _cancell_check_binaryBITS(a, b, res, ctx, threshold, counted) is the check
+ * called after each operation, _cancell_binaryBITS runs it with the
+ * configuration of the context. If counted is set and the operations update
+ * the per-thread state, it returns at once while the checking is stopped on
+ * the thread or if the operation is not sampled. Its fast path only compares
+ * the biased exponents with _no_cancellation, and leaves the results that
+ * are zero or subnormal to the slow path. The slow path, kept out of line,
+ * returns while the checking is stopped, records the cancellations and, in
+ * mca mode, adds a MCA noise of the magnitude of the cancelled bits. This
+ * particular version in the case of cancellations does not use extended quad
+ * types. */
+#define define_cancell(BITS, TYPE, PMAN_SIZE, EXP_COMP, EXP_INF)               \
+  static inline int _cancellation_size_binary##BITS(                           \
+      const TYPE a, const TYPE b, const TYPE z, int32_t *e_z) {                \
+    const int32_t e_inf = EXP_INF;                                             \
+    const int32_t biased_z = _biased_exponent_binary##BITS(z);                 \
+    if (__builtin_expect(biased_z != 0, 1)) {                                  \
+      if (biased_z == e_inf) {                                                 \
+        /* infinities and NaNs do not cancel */                                \
+        return -1;                                                             \
+      }                                                                        \
+      /* a normal result: the operands that are subnormal or zero cannot       \
+       * be the largest ones in a cancellation, the biased exponents           \
+       * suffice */                                                            \
+      *e_z = biased_z - EXP_COMP;                                              \
+      return max(_biased_exponent_binary##BITS(a),                             \
+                 _biased_exponent_binary##BITS(b)) -                           \
+             biased_z;                                                         \
+    }                                                                          \
+    if (a == 0 && b == 0) {                                                    \
+      return -1;                                                               \
+    }                                                                          \
+    const int32_t e_a = (a == 0) ? INT32_MIN : _exponent_binary##BITS(a);      \
+    const int32_t e_b = (b == 0) ? INT32_MIN : _exponent_binary##BITS(b);      \
+    if (z == 0) {                                                              \
+      *e_z = max(e_a, e_b) - (PMAN_SIZE + 1);                                  \
+      return PMAN_SIZE + 1;                                                    \
+    }                                                                          \
+    *e_z = _exponent_binary##BITS(z);                                          \
+    return max(e_a, e_b) - *e_z;                                               \
+  }                                                                            \
+                                                                               \
+  /* counts the cancellation of result z if z is zero or subnormal. Its noise  \
+   * of exponent e_n has vanished at or below 2^E_MIN, where even a random     \
+   * number of 0.5 rounds to zero */                                           \
+  static inline void _underflow_record_binary##BITS(                           \
+      thread_state_t *state, const TYPE z, const int32_t e_n,                  \
+      const cancellation_context_t *ctx) {                                     \
+    const int32_t E_MIN = -(EXP_COMP + PMAN_SIZE - 1);                         \
+    if (__builtin_expect(_biased_exponent_binary##BITS(z) == 0, 0)) {          \
+      _underflow_add(state, precision_binary##BITS, z == 0,                    \
+                     ctx->mode != cancellation_mode_detect && e_n <= E_MIN);   \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* records the cancellation of size cancellation of the result *res of       \
+   * exponent e_z, and perturbs the result in mca mode if it reaches the       \
+   * tolerance of the thread of state */                                       \
+  static void _cancell_apply_binary##BITS(                                     \
+      thread_state_t *state, const int cancellation, const int tolerance,      \
+      const int32_t e_z, TYPE *res, const cancellation_context_t *ctx) {       \
+    if (ctx->histogram_file != NULL && cancellation >= 0) {                    \
+      _histogram_add(state, precision_binary##BITS, cancellation);             \
+    }                                                                          \
+    if (cancellation >= tolerance) {                                           \
+      _record_cancellation(state, cancellation, ctx);                          \
+      const int32_t e_n = e_z - (cancellation - 1);                            \
+      _underflow_record_binary##BITS(state, *res, e_n, ctx);                   \
+      if (ctx->mode == cancellation_mode_detect) {                             \
+        return;                                                                \
+      }                                                                        \
+      if (__builtin_expect(ctx->samples > 1, 0)) {                             \
+        _multi_sample_binary##BITS(cancellation, e_n, res, ctx);               \
+      } else {                                                                 \
+        perturb_binary##BITS(res, e_n, ctx);                                   \
+      }                                                                        \
+      _stats_add_noises(state, 1);                                             \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  __attribute__((cold, noinline)) static void                                  \
+      _cancell_slow_binary##BITS(const TYPE a, const TYPE b, TYPE *res,        \
+                                 const cancellation_context_t *ctx) {          \
+    _profile_slow();                                                           \
+    thread_state_t *state = _get_thread_state();                               \
+    if (state->checking_disabled) {                                            \
+      return;                                                                  \
+    }                                                                          \
+    int32_t e_z = 0;                                                           \
+    const int cancellation =                                                   \
+        _cancellation_size_binary##BITS(a, b, *res, &e_z);                     \
+    const int tolerance = _thread_tolerance(state, ctx);                       \
+    if (trace_fd >= 0 && cancellation >= tolerance) {                          \
+      _trace_add(state, cancellation_trace_op_add_sub, BITS, cancellation,     \
+                 TRACE_EXPONENT(a), TRACE_EXPONENT(b));                        \
+    }                                                                          \
+    _cancell_apply_binary##BITS(state, cancellation, tolerance, e_z, res,      \
+                                ctx);                                          \
+  }                                                                            \
+                                                                               \
+  __attribute__((always_inline)) static inline void                            \
+      _cancell_check_binary##BITS(const TYPE a, const TYPE b, TYPE *res,       \
+                                  const cancellation_context_t *ctx,           \
+                                  const int threshold, const bool counted) {   \
+    if (counted &&                                                             \
+        __builtin_expect(                                                      \
+            __atomic_load_n(&per_operation_state, __ATOMIC_RELAXED), 0)) {     \
+      thread_state_t *state = _get_thread_state();                             \
+      _mpi_poll(state);                                                        \
+      if (state->checking_disabled) {                                          \
+        return;                                                                \
+      }                                                                        \
+      _stats_add_operations(state, 1);                                         \
+      if (sampling && _sample_skip(state, ctx)) {                              \
+        return;                                                                \
+      }                                                                        \
+    }                                                                          \
+    const int32_t e_a = _biased_exponent_binary##BITS(a);                      \
+    const int32_t e_b = _biased_exponent_binary##BITS(b);                      \
+    const int32_t e_res = _biased_exponent_binary##BITS(*res);                 \
+    if (counted && __builtin_expect(ctx->histogram_file != NULL, 0)) {         \
+      if (_histogram_inline(precision_binary##BITS, max(e_a, e_b), e_res,      \
+                            EXP_INF, threshold)) {                             \
+        return;                                                                \
+      }                                                                        \
+    } else if (__builtin_expect(                                               \
+                   _no_cancellation(e_a, e_b, e_res, threshold), 1)) {         \
+      return;                                                                  \
+    }                                                                          \
+    _cancell_slow_binary##BITS(a, b, res, ctx);                                \
+  }                                                                            \
+                                                                               \
+  static inline void _cancell_binary##BITS(const TYPE a, const TYPE b,         \
+                                           TYPE *res, void *context) {         \
+    const cancellation_context_t *ctx = (cancellation_context_t *)context;     \
+    _cancell_check_binary##BITS(a, b, res, ctx, _lane_threshold(ctx), true);   \
+  }
+
+define_cancell(32, float, FLOAT_PMAN_SIZE, FLOAT_EXP_COMP, 0xFF);
+define_cancell(64, double, DOUBLE_PMAN_SIZE, DOUBLE_EXP_COMP, 0x7FF);
+
+#define CANCELL(A, B, RES, CTX)                                                \
+  _Generic(*(RES), float: _cancell_binary32, double: _cancell_binary64)(       \
+      A, B, RES, CTX)
+
+#define CANCELLATION_SIZE(A, B, Z, E_Z)                                        \
+  _Generic((Z),                                                                \
+      float: _cancellation_size_binary32,                                      \
+      double: _cancellation_size_binary64)(A, B, Z, E_Z)
+
+#define UNDERFLOW_RECORD(STATE, Z, E_N, CTX)                                   \
+  _Generic((Z),                                                                \
+      float: _underflow_record_binary32,                                       \
+      double: _underflow_record_binary64)(STATE, Z, E_N, CTX)
+
 #define _u_ __attribute__((unused))
 
 /* Cancellations can only happen during additions and substractions */
 void INTERFLOP_CANCELLATION_API(add_float)(float a, float b, float *res,
                                            void *context) {
   *res = a + b;
-  cancell(a, b, res, context, rng_state);
+  CANCELL(a, b, res, context);
 }
 void INTERFLOP_CANCELLATION_API(sub_float)(float a, float b, float *res,
                                            void *context) {
   *res = a - b;
-  cancell(a, b, res, context, rng_state);
+  CANCELL(a, b, res, context);
 }
 
+/* Callbacks specialized by init for the configurations with no histogram,
+ * no live counters, no tolerance file and no MPI hook to poll, whose fast
+ * path reads at most the tolerance or the sampling countdown:
+ * - fast: a tolerance of 1, the default, folded in the threshold;
+ * - tolerance: any other tolerance, read from the context without the
+ *   lookups of _lane_threshold;
+ * - sampled: with --sample-period or --sample-rate, each operation only
+ *   counts down the sampling of its thread, without the check of
+ *   per_operation_state.
+ * The slow path still compares the sizes to the tolerance of the context, so
+ * the tolerances set later by a user call are honoured, except the ones below
+ * 1 with the fast callbacks. */
+typedef enum {
+  callbacks_generic,
+  callbacks_fast,
+  callbacks_tolerance,
+  callbacks_sampled,
+  _callbacks_end_
+} callbacks_t;
+
+#ifdef SELF_PROFILING
+/* names of the callbacks in the self-profile */
+static const char *CALLBACKS_STR[] = {"generic", "fast", "tolerance",
+                                      "sampled"};
+#endif
+
+/* callbacks selected by init */
+static callbacks_t callbacks = callbacks_generic;
+
+/* Threshold of the tolerance and sampled callbacks */
+static inline int _context_threshold(const cancellation_context_t *ctx) {
+  return min(_context_tolerance(ctx), THRESHOLD_MAX);
+}
+
+/* Returns true if the sampled callbacks skip the operation */
+static inline bool _sampled_skip(const cancellation_context_t *ctx) {
+  thread_state_t *state = _get_thread_state();
+  return state->checking_disabled || _sample_skip(state, ctx);
+}
+
+#define define_fast_op(NAME, TYPE, BITS, OP)                                   \
+  static void _##NAME##_fast(TYPE a, TYPE b, TYPE *res, void *context) {       \
+    *res = a OP b;                                                             \
+    _cancell_check_binary##BITS(a, b, res, context, 1, false);                 \
+  }                                                                            \
+                                                                               \
+  static void _##NAME##_tolerance(TYPE a, TYPE b, TYPE *res, void *context) {  \
+    *res = a OP b;                                                             \
+    _cancell_check_binary##BITS(a, b, res, context,                            \
+                                _context_threshold(context), false);           \
+  }                                                                            \
+                                                                               \
+  static void _##NAME##_sampled(TYPE a, TYPE b, TYPE *res, void *context) {    \
+    *res = a OP b;                                                             \
+    if (__builtin_expect(_sampled_skip(context), 1)) {                         \
+      return;                                                                  \
+    }                                                                          \
+    _cancell_check_binary##BITS(a, b, res, context,                            \
+                                _context_threshold(context), false);           \
+  }                                                                            \
+                                                                               \
+  /* indexed by callbacks_t */                                                 \
+  static void (*const NAME##_callbacks[])(TYPE, TYPE, TYPE *, void *) = {      \
+      INTERFLOP_CANCELLATION_API(NAME), _##NAME##_fast, _##NAME##_tolerance,   \
+      _##NAME##_sampled};                                                      
+
+define_fast_op(add_float, float, 32, +);
+define_fast_op(sub_float, float, 32, -);
+define_fast_op(add_double, double, 64, +);
+define_fast_op(sub_double, double, 64, -);
+
 void INTERFLOP_CANCELLATION_API(mul_float)(float a, float b, float *res,
                                            _u_ void *context) {
   *res = a * b;
@@ -157,12 +3126,12 @@ void INTERFLOP_CANCELLATION_API(div_float)(float a, float b, float *res,
 void INTERFLOP_CANCELLATION_API(add_double)(double a, double b, double *res,
                                             void *context) {
   *res = a + b;
-  cancell(a, b, res, context, rng_state);
+  CANCELL(a, b, res, context);
 }
 void INTERFLOP_CANCELLATION_API(sub_double)(double a, double b, double *res,
                                             void *context) {
   *res = a - b;
-  cancell(a, b, res, context, rng_state);
+  CANCELL(a, b, res, context);
 }
 
 void INTERFLOP_CANCELLATION_API(mul_double)(double a, double b, double *res,
@@ -175,14 +3144,332 @@ void INTERFLOP_CANCELLATION_API(div_double)(double a, double b, double *res,
   *res = a / b;
 }
 
+/* FMAs: the cancellation is the one between the exact product a * b and the
+ * addend c, max(e_ab, e_c) - e_z. The exponent of the exact product is
+ * e_a + e_b, plus one when the product of the significands is at least 2,
+ * which is read from the high bits of an integer product of the
+ * significands. No rounded product is computed, so the detection does not
+ * depend on the contraction of the multiplications and additions. */
+
+/* High 64 bits of the 128-bit product x * y */
+static inline uint64_t _mul_hi_u64(const uint64_t x, const uint64_t y) {
+  const uint64_t x0 = x & 0xFFFFFFFF, x1 = x >> 32;
+  const uint64_t y0 = y & 0xFFFFFFFF, y1 = y >> 32;
+  const uint64_t p01 = x0 * y1, p10 = x1 * y0;
+  const uint64_t mid =
+      ((x0 * y0) >> 32) + (p01 & 0xFFFFFFFF) + (p10 & 0xFFFFFFFF);
+  return x1 * y1 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+}
+
+/* Carry of the product of two significands of PMAN_SIZE + 1 bits with their
+ * leading bit set: 1 if the product is at least 2 */
+static inline int32_t _product_carry_binary32(const uint32_t m_a,
+                                              const uint32_t m_b) {
+  return ((uint64_t)m_a * m_b) >> (2 * FLOAT_PMAN_SIZE + 1);
+}
+
+static inline int32_t _product_carry_binary64(const uint64_t m_a,
+                                              const uint64_t m_b) {
+  return _mul_hi_u64(m_a, m_b) >> (2 * DOUBLE_PMAN_SIZE + 1 - 64);
+}
+
+/* Defines the FMA cancellation test of binaryBITS:
+ *
+ * _significand_binaryBITS(x) is the significand of x with its implicit bit,
+ * _normalized_significand_binaryBITS(x) shifts the one of a subnormal to set
+ * its leading bit.
+ *
+ * _fma_cancellation_size_binaryBITS(a, b, c, z, &e_z) returns the size of the
+ * cancellation of z = a * b + c and the exponent e_z of the result, with the
+ * conventions of _cancellation_size_binaryBITS. A zero product or addend does
+ * not cancel.
+ *
+ * _fma_check_binaryBITS is the check called after each FMA, like
+ * _cancell_check_binaryBITS. Its fast path works on the biased exponents and
+ * the significands with the implicit bit forced; for a zero or subnormal
+ * operand it overestimates the product, so that no cancellation is
+ * missed. */
+#define define_fma_cancell(BITS, TYPE, UINT, CLZ, PMAN_SIZE, EXP_COMP,         \
+                           EXP_INF)                                            \
+  static inline UINT _significand_binary##BITS(const TYPE x) {                 \
+    binary##BITS b = {.f##BITS = x};                                           \
+    return (b.u##BITS & (((UINT)1 << PMAN_SIZE) - 1)) |                        \
+           ((UINT)1 << PMAN_SIZE);                                             \
+  }                                                                            \
+                                                                               \
+  static inline UINT _normalized_significand_binary##BITS(const TYPE x) {      \
+    binary##BITS b = {.f##BITS = x};                                           \
+    const UINT mantissa = b.u##BITS & (((UINT)1 << PMAN_SIZE) - 1);            \
+    if (_biased_exponent_binary##BITS(x) == 0) {                               \
+      return mantissa << (CLZ(mantissa) - (BITS - 1 - PMAN_SIZE));             \
+    }                                                                          \
+    return mantissa | ((UINT)1 << PMAN_SIZE);                                  \
+  }                                                                            \
+                                                                               \
+  /* exponent of the exact product of the non-zero a and b */                  \
+  static inline int32_t _product_exponent_binary##BITS(const TYPE a,           \
+                                                       const TYPE b) {         \
+    return _exponent_binary##BITS(a) + _exponent_binary##BITS(b) +             \
+           _product_carry_binary##BITS(                                        \
+               _normalized_significand_binary##BITS(a),                        \
+               _normalized_significand_binary##BITS(b));                       \
+  }                                                                            \
+                                                                               \
+  static int _fma_cancellation_size_binary##BITS(const TYPE a, const TYPE b,   \
+                                                 const TYPE c, const TYPE z,   \
+                                                 int32_t *e_z) {               \
+    if (_biased_exponent_binary##BITS(z) == EXP_INF || a == 0 || b == 0 ||     \
+        c == 0) {                                                              \
+      return -1;                                                               \
+    }                                                                          \
+    const int32_t e_max =                                                      \
+        max(_product_exponent_binary##BITS(a, b), _exponent_binary##BITS(c));  \
+    if (z == 0) {                                                              \
+      *e_z = e_max - (PMAN_SIZE + 1);                                          \
+      return PMAN_SIZE + 1;                                                    \
+    }                                                                          \
+    *e_z = _exponent_binary##BITS(z);                                          \
+    return e_max - *e_z;                                                       \
+  }                                                                            \
+                                                                               \
+  __attribute__((cold, noinline)) static void                                  \
+      _fma_cancell_slow_binary##BITS(const TYPE a, const TYPE b, const TYPE c, \
+                                     TYPE *res,                                \
+                                     const cancellation_context_t *ctx) {      \
+    _profile_slow();                                                           \
+    thread_state_t *state = _get_thread_state();                               \
+    if (state->checking_disabled) {                                            \
+      return;                                                                  \
+    }                                                                          \
+    int32_t e_z = 0;                                                           \
+    const int cancellation =                                                   \
+        _fma_cancellation_size_binary##BITS(a, b, c, *res, &e_z);              \
+    const int tolerance = _thread_tolerance(state, ctx);                       \
+    if (trace_fd >= 0 && cancellation >= tolerance) {                          \
+      _trace_add(state, cancellation_trace_op_fma, BITS, cancellation,         \
+                 _product_exponent_binary##BITS(a, b),                         \
+                 _exponent_binary##BITS(c));                                   \
+    }                                                                          \
+    _cancell_apply_binary##BITS(state, cancellation, tolerance, e_z, res,      \
+                                ctx);                                          \
+  }                                                                            \
+                                                                               \
+  __attribute__((always_inline)) static inline void                            \
+      _fma_check_binary##BITS(const TYPE a, const TYPE b, const TYPE c,        \
+                              TYPE *res, const cancellation_context_t *ctx,    \
+                              const int threshold, const bool counted) {       \
+    if (counted &&                                                             \
+        __builtin_expect(                                                      \
+            __atomic_load_n(&per_operation_state, __ATOMIC_RELAXED), 0)) {     \
+      thread_state_t *state = _get_thread_state();                             \
+      _mpi_poll(state);                                                        \
+      if (state->checking_disabled) {                                          \
+        return;                                                                \
+      }                                                                        \
+      _stats_add_operations(state, 1);                                         \
+      if (sampling && _sample_skip(state, ctx)) {                              \
+        return;                                                                \
+      }                                                                        \
+    }                                                                          \
+    const int32_t e_ab =                                                       \
+        _biased_exponent_binary##BITS(a) + _biased_exponent_binary##BITS(b) -  \
+        EXP_COMP +                                                             \
+        _product_carry_binary##BITS(_significand_binary##BITS(a),              \
+                                    _significand_binary##BITS(b));             \
+    const int32_t e_c = _biased_exponent_binary##BITS(c);                      \
+    const int32_t e_res = _biased_exponent_binary##BITS(*res);                 \
+    if (counted && __builtin_expect(ctx->histogram_file != NULL, 0)) {         \
+      /* the biased exponents are exact if no operand is zero or subnormal */  \
+      if (_biased_exponent_binary##BITS(a) != 0 &&                             \
+          _biased_exponent_binary##BITS(b) != 0 && e_c != 0 &&                 \
+          _histogram_inline(precision_binary##BITS, max(e_ab, e_c), e_res,     \
+                            EXP_INF, threshold)) {                             \
+        return;                                                                \
+      }                                                                        \
+    } else if (__builtin_expect(_no_cancellation(e_ab, e_c, e_res, threshold), \
+                                1)) {                                          \
+      return;                                                                  \
+    }                                                                          \
+    _fma_cancell_slow_binary##BITS(a, b, c, res, ctx);                         \
+  }
+
+define_fma_cancell(32, float, uint32_t, __builtin_clz, FLOAT_PMAN_SIZE,
+                   FLOAT_EXP_COMP, 0xFF);
+define_fma_cancell(64, double, uint64_t, __builtin_clzll, DOUBLE_PMAN_SIZE,
+                   DOUBLE_EXP_COMP, 0x7FF);
+
 void INTERFLOP_CANCELLATION_API(fma_float)(float a, float b, float c,
-                                           float *res, _u_ void *context) {
+                                           float *res, void *context) {
+  const cancellation_context_t *ctx = (cancellation_context_t *)context;
   *res = interflop_fma_binary32(a, b, c);
+  _fma_check_binary32(a, b, c, res, ctx, _lane_threshold(ctx), true);
 }
 
 void INTERFLOP_CANCELLATION_API(fma_double)(double a, double b, double c,
-                                            double *res, _u_ void *context) {
+                                            double *res, void *context) {
+  const cancellation_context_t *ctx = (cancellation_context_t *)context;
   *res = interflop_fma_binary64(a, b, c);
+  _fma_check_binary64(a, b, c, res, ctx, _lane_threshold(ctx), true);
+}
+
+/* FMA callbacks of the specialized configurations */
+#define define_fast_fma(TYPE, BITS)                                            \
+  static void _fma_##TYPE##_fast(TYPE a, TYPE b, TYPE c, TYPE *res,            \
+                                 void *context) {                              \
+    *res = interflop_fma_binary##BITS(a, b, c);                                \
+    _fma_check_binary##BITS(a, b, c, res, context, 1, false);                  \
+  }                                                                            \
+                                                                               \
+  static void _fma_##TYPE##_tolerance(TYPE a, TYPE b, TYPE c, TYPE *res,       \
+                                      void *context) {                         \
+    *res = interflop_fma_binary##BITS(a, b, c);                                \
+    _fma_check_binary##BITS(a, b, c, res, context,                             \
+                            _context_threshold(context), false);               \
+  }                                                                            \
+                                                                               \
+  static void _fma_##TYPE##_sampled(TYPE a, TYPE b, TYPE c, TYPE *res,         \
+                                    void *context) {                           \
+    *res = interflop_fma_binary##BITS(a, b, c);                                \
+    if (__builtin_expect(_sampled_skip(context), 1)) {                         \
+      return;                                                                  \
+    }                                                                          \
+    _fma_check_binary##BITS(a, b, c, res, context,                             \
+                            _context_threshold(context), false);               \
+  }                                                                            \
+                                                                               \
+  /* indexed by callbacks_t */                                                 \
+  static void (*const fma_##TYPE##_callbacks[])(TYPE, TYPE, TYPE, TYPE *,      \
+                                                void *) = {                    \
+      INTERFLOP_CANCELLATION_API(fma_##TYPE), _fma_##TYPE##_fast,              \
+      _fma_##TYPE##_tolerance, _fma_##TYPE##_sampled};                         
+
+define_fast_fma(float, 32);
+define_fast_fma(double, 64);
+
+/* Comparisons and casts are not perturbed. With --precision-loss, init
+ * selects the callbacks below that count the precision losses they expose,
+ * their fast paths cost one exponent or exactness test */
+
+/* Result of the comparison p of a and b. The binary32 operands are widened
+ * exactly, which keeps their ordering */
+static inline int _fcmp(const enum FCMP_PREDICATE p, const double a,
+                        const double b) {
+  switch (p) {
+  case FCMP_FALSE:
+    return 0;
+  case FCMP_OEQ:
+    return a == b;
+  case FCMP_OGT:
+    return a > b;
+  case FCMP_OGE:
+    return a >= b;
+  case FCMP_OLT:
+    return a < b;
+  case FCMP_OLE:
+    return a <= b;
+  case FCMP_ONE:
+    return a < b || a > b;
+  case FCMP_ORD:
+    return !__builtin_isunordered(a, b);
+  case FCMP_UNO:
+    return __builtin_isunordered(a, b);
+  case FCMP_UEQ:
+    return !(a < b || a > b);
+  case FCMP_UGT:
+    return !(a <= b);
+  case FCMP_UGE:
+    return !(a < b);
+  case FCMP_ULT:
+    return !(a >= b);
+  case FCMP_ULE:
+    return !(a > b);
+  case FCMP_UNE:
+    return a != b;
+  default:
+    return 1;
+  }
+}
+
+/* Defines the comparison of binaryBITS. The operands are nearly equal when
+ * their difference cancels by at least the tolerance, as a subtraction would
+ * be perturbed. Equal operands are a total cancellation */
+#define define_cmp(BITS, TYPE)                                                 \
+  static void _cmp_slow_binary##BITS(const TYPE a, const TYPE b, const TYPE z, \
+                                     const cancellation_context_t *ctx) {      \
+    if (_get_thread_state()->checking_disabled) {                              \
+      return;                                                                  \
+    }                                                                          \
+    int32_t e_z = 0;                                                           \
+    const int cancellation = _cancellation_size_binary##BITS(a, b, z, &e_z);   \
+    if (cancellation < _tolerance(ctx)) {                                      \
+      return;                                                                  \
+    }                                                                          \
+    precision_loss_t *loss = _get_precision_loss();                            \
+    _precision_loss_add(&loss->unstable_cmp[precision_binary##BITS]);          \
+    _precision_loss_max(&loss->unstable_cmp_max[precision_binary##BITS],       \
+                        cancellation);                                         \
+  }                                                                            \
+                                                                               \
+  static void _cmp_##TYPE##_checked(enum FCMP_PREDICATE p, TYPE a, TYPE b,     \
+                                    int *res, void *context) {                 \
+    const cancellation_context_t *ctx = (cancellation_context_t *)context;     \
+    *res = _fcmp(p, a, b);                                                     \
+    const TYPE z = a - b;                                                      \
+    const int32_t e_z = _biased_exponent_binary##BITS(z);                      \
+    const int32_t cancellation = max(_biased_exponent_binary##BITS(a),         \
+                                     _biased_exponent_binary##BITS(b)) -       \
+                                 e_z;                                          \
+    if (__builtin_expect((cancellation < _tolerance(ctx)) & (e_z != 0), 1)) {  \
+      return;                                                                  \
+    }                                                                          \
+    _cmp_slow_binary##BITS(a, b, z, ctx);                                      \
+  }
+
+define_cmp(32, float);
+define_cmp(64, double);
+
+void INTERFLOP_CANCELLATION_API(cmp_float)(enum FCMP_PREDICATE p, float a,
+                                           float b, int *res,
+                                           _u_ void *context) {
+  *res = _fcmp(p, a, b);
+}
+
+void INTERFLOP_CANCELLATION_API(cmp_double)(enum FCMP_PREDICATE p, double a,
+                                            double b, int *res,
+                                            _u_ void *context) {
+  *res = _fcmp(p, a, b);
+}
+
+/* Classifies an inexact cast of a to b. A finite double that rounds to a
+ * normal float is normal, the discarded significant bits are the ones of its
+ * significand below the float precision, up to its last set bit */
+static void _cast_slow(const double a, const float b) {
+  if (a != a || _get_thread_state()->checking_disabled) {
+    return;
+  }
+  precision_loss_t *loss = _get_precision_loss();
+  const int32_t e_b = _biased_exponent_binary32(b);
+  if (e_b == 0xFF) {
+    _precision_loss_add(&loss->cast_overflow);
+  } else if (e_b == 0) {
+    _precision_loss_add(&loss->cast_underflow);
+  } else {
+    binary64 b64 = {.f64 = a};
+    const uint64_t mantissa = b64.u64 & ((1ULL << DOUBLE_PMAN_SIZE) - 1);
+    const int32_t lost_bits =
+        DOUBLE_PMAN_SIZE - FLOAT_PMAN_SIZE - __builtin_ctzll(mantissa);
+    _precision_loss_add(&loss->cast_inexact);
+    _precision_loss_max(&loss->cast_max_lost_bits, lost_bits);
+  }
+}
+
+static void _cast_double_to_float_checked(double a, float *b,
+                                          _u_ void *context) {
+  *b = (float)a;
+  if (__builtin_expect((double)*b == a, 1)) {
+    return;
+  }
+  _cast_slow(a, *b);
 }
 
 void INTERFLOP_CANCELLATION_API(cast_double_to_float)(double a, float *b,
@@ -190,10 +3477,524 @@ void INTERFLOP_CANCELLATION_API(cast_double_to_float)(double a, float *b,
   *b = (float)a;
 }
 
+/* Packed operations: the lanes are computed with SIMD instructions and are
+ * tested for cancellations at once. Only the lanes that need a noise or a
+ * record go through the slow path. On x86-64, the implementation is selected
+ * at load time through an ifunc resolver, from the features of the CPU */
+
+typedef void (*packed_float_op_t)(const float *a, const float *b, float *res,
+                                  void *context);
+typedef void (*packed_double_op_t)(const double *a, const double *b,
+                                   double *res, void *context);
+
+/* Runs the slow path of the cancellation test on the lanes set in mask. With
+ * a histogram, the mask holds every lane and the ones that cancel less than
+ * the tolerance are only counted */
+static void _cancell_lanes_float(const float *a, const float *b, float *res,
+                                 uint32_t mask, void *context) {
+  const bool histogram =
+      ((cancellation_context_t *)context)->histogram_file != NULL;
+  const int threshold = histogram ? _lane_threshold(context) : 0;
+  for (; mask != 0; mask &= mask - 1) {
+    const int i = __builtin_ctz(mask);
+    if (histogram && _histogram_inline(precision_binary32,
+                                       max(_biased_exponent_binary32(a[i]),
+                                           _biased_exponent_binary32(b[i])),
+                                       _biased_exponent_binary32(res[i]), 0xFF,
+                                       threshold)) {
+      continue;
+    }
+    _cancell_slow_binary32(a[i], b[i], &res[i], context);
+  }
+}
+
+static void _cancell_lanes_double(const double *a, const double *b,
+                                  double *res, uint32_t mask, void *context) {
+  const bool histogram =
+      ((cancellation_context_t *)context)->histogram_file != NULL;
+  const int threshold = histogram ? _lane_threshold(context) : 0;
+  for (; mask != 0; mask &= mask - 1) {
+    const int i = __builtin_ctz(mask);
+    if (histogram && _histogram_inline(precision_binary64,
+                                       max(_biased_exponent_binary64(a[i]),
+                                           _biased_exponent_binary64(b[i])),
+                                       _biased_exponent_binary64(res[i]), 0x7FF,
+                                       threshold)) {
+      continue;
+    }
+    _cancell_slow_binary64(a[i], b[i], &res[i], context);
+  }
+}
+
+/* Scalar fallback, one scalar callback per lane */
+#define define_packed_scalar(OP, TYPE, N)                                      \
+  static void _##OP##_##TYPE##_##N##_scalar(const TYPE *a, const TYPE *b,      \
+                                            TYPE *res, void *context) {        \
+    for (int i = 0; i < N; i++) {                                              \
+      INTERFLOP_CANCELLATION_API(OP##_##TYPE)(a[i], b[i], &res[i], context);   \
+    }                                                                          \
+  }
+
+#if defined(__x86_64__)
+
+/* Masks of the lanes whose cancellation is at least threshold, or whose
+ * result is zero or subnormal, as in the fast path of _cancell_binaryBITS */
+__attribute__((target("avx2"))) static inline uint32_t
+_mask_double_2_avx2(__m128d a, __m128d b, __m128d z, const int threshold) {
+  const __m128i exp = _mm_set1_epi64x(0x7FF);
+  const __m128i e_a =
+      _mm_and_si128(_mm_srli_epi64(_mm_castpd_si128(a), DOUBLE_PMAN_SIZE), exp);
+  const __m128i e_b =
+      _mm_and_si128(_mm_srli_epi64(_mm_castpd_si128(b), DOUBLE_PMAN_SIZE), exp);
+  const __m128i e_z =
+      _mm_and_si128(_mm_srli_epi64(_mm_castpd_si128(z), DOUBLE_PMAN_SIZE), exp);
+  const __m128i e_max = _mm_blendv_epi8(e_b, e_a, _mm_cmpgt_epi64(e_a, e_b));
+  const __m128i cancellation = _mm_sub_epi64(e_max, e_z);
+  const __m128i hit = _mm_or_si128(
+      _mm_cmpgt_epi64(cancellation, _mm_set1_epi64x(threshold - 1)),
+      _mm_cmpeq_epi64(e_z, _mm_setzero_si128()));
+  return _mm_movemask_pd(_mm_castsi128_pd(hit));
+}
+
+__attribute__((target("avx2"))) static inline uint32_t
+_mask_double_4_avx2(__m256d a, __m256d b, __m256d z, const int threshold) {
+  const __m256i exp = _mm256_set1_epi64x(0x7FF);
+  const __m256i e_a = _mm256_and_si256(
+      _mm256_srli_epi64(_mm256_castpd_si256(a), DOUBLE_PMAN_SIZE), exp);
+  const __m256i e_b = _mm256_and_si256(
+      _mm256_srli_epi64(_mm256_castpd_si256(b), DOUBLE_PMAN_SIZE), exp);
+  const __m256i e_z = _mm256_and_si256(
+      _mm256_srli_epi64(_mm256_castpd_si256(z), DOUBLE_PMAN_SIZE), exp);
+  const __m256i e_max =
+      _mm256_blendv_epi8(e_b, e_a, _mm256_cmpgt_epi64(e_a, e_b));
+  const __m256i cancellation = _mm256_sub_epi64(e_max, e_z);
+  const __m256i hit = _mm256_or_si256(
+      _mm256_cmpgt_epi64(cancellation, _mm256_set1_epi64x(threshold - 1)),
+      _mm256_cmpeq_epi64(e_z, _mm256_setzero_si256()));
+  return _mm256_movemask_pd(_mm256_castsi256_pd(hit));
+}
+
+__attribute__((target("avx2"))) static inline uint32_t
+_mask_float_4_avx2(__m128 a, __m128 b, __m128 z, const int threshold) {
+  const __m128i exp = _mm_set1_epi32(0xFF);
+  const __m128i e_a =
+      _mm_and_si128(_mm_srli_epi32(_mm_castps_si128(a), FLOAT_PMAN_SIZE), exp);
+  const __m128i e_b =
+      _mm_and_si128(_mm_srli_epi32(_mm_castps_si128(b), FLOAT_PMAN_SIZE), exp);
+  const __m128i e_z =
+      _mm_and_si128(_mm_srli_epi32(_mm_castps_si128(z), FLOAT_PMAN_SIZE), exp);
+  const __m128i cancellation = _mm_sub_epi32(_mm_max_epi32(e_a, e_b), e_z);
+  const __m128i hit = _mm_or_si128(
+      _mm_cmpgt_epi32(cancellation, _mm_set1_epi32(threshold - 1)),
+      _mm_cmpeq_epi32(e_z, _mm_setzero_si128()));
+  return _mm_movemask_ps(_mm_castsi128_ps(hit));
+}
+
+__attribute__((target("avx2"))) static inline uint32_t
+_mask_float_8_avx2(__m256 a, __m256 b, __m256 z, const int threshold) {
+  const __m256i exp = _mm256_set1_epi32(0xFF);
+  const __m256i e_a = _mm256_and_si256(
+      _mm256_srli_epi32(_mm256_castps_si256(a), FLOAT_PMAN_SIZE), exp);
+  const __m256i e_b = _mm256_and_si256(
+      _mm256_srli_epi32(_mm256_castps_si256(b), FLOAT_PMAN_SIZE), exp);
+  const __m256i e_z = _mm256_and_si256(
+      _mm256_srli_epi32(_mm256_castps_si256(z), FLOAT_PMAN_SIZE), exp);
+  const __m256i cancellation =
+      _mm256_sub_epi32(_mm256_max_epi32(e_a, e_b), e_z);
+  const __m256i hit = _mm256_or_si256(
+      _mm256_cmpgt_epi32(cancellation, _mm256_set1_epi32(threshold - 1)),
+      _mm256_cmpeq_epi32(e_z, _mm256_setzero_si256()));
+  return _mm256_movemask_ps(_mm256_castsi256_ps(hit));
+}
+
+__attribute__((target("avx512f"))) static inline uint32_t
+_mask_double_8_avx512f(__m512d a, __m512d b, __m512d z, const int threshold) {
+  const __m512i exp = _mm512_set1_epi64(0x7FF);
+  const __m512i e_a = _mm512_and_si512(
+      _mm512_srli_epi64(_mm512_castpd_si512(a), DOUBLE_PMAN_SIZE), exp);
+  const __m512i e_b = _mm512_and_si512(
+      _mm512_srli_epi64(_mm512_castpd_si512(b), DOUBLE_PMAN_SIZE), exp);
+  const __m512i e_z = _mm512_and_si512(
+      _mm512_srli_epi64(_mm512_castpd_si512(z), DOUBLE_PMAN_SIZE), exp);
+  const __m512i cancellation =
+      _mm512_sub_epi64(_mm512_max_epi64(e_a, e_b), e_z);
+  return _mm512_cmpgt_epi64_mask(cancellation,
+                                 _mm512_set1_epi64(threshold - 1)) |
+         _mm512_cmpeq_epi64_mask(e_z, _mm512_setzero_si512());
+}
+
+__attribute__((target("avx512f"))) static inline uint32_t
+_mask_float_16_avx512f(__m512 a, __m512 b, __m512 z, const int threshold) {
+  const __m512i exp = _mm512_set1_epi32(0xFF);
+  const __m512i e_a = _mm512_and_si512(
+      _mm512_srli_epi32(_mm512_castps_si512(a), FLOAT_PMAN_SIZE), exp);
+  const __m512i e_b = _mm512_and_si512(
+      _mm512_srli_epi32(_mm512_castps_si512(b), FLOAT_PMAN_SIZE), exp);
+  const __m512i e_z = _mm512_and_si512(
+      _mm512_srli_epi32(_mm512_castps_si512(z), FLOAT_PMAN_SIZE), exp);
+  const __m512i cancellation =
+      _mm512_sub_epi32(_mm512_max_epi32(e_a, e_b), e_z);
+  return _mm512_cmpgt_epi32_mask(cancellation,
+                                 _mm512_set1_epi32(threshold - 1)) |
+         _mm512_cmpeq_epi32_mask(e_z, _mm512_setzero_si512());
+}
+
+/* SIMD kernel, PFX and SFX are the prefix and suffix of the intrinsics */
+#define define_packed_simd(OP, TYPE, N, ISA, VEC, PFX, SFX)                    \
+  __attribute__((target(#ISA))) static void _##OP##_##TYPE##_##N##_##ISA(      \
+      const TYPE *a, const TYPE *b, TYPE *res, void *context) {                \
+    const VEC va = PFX##_loadu_##SFX(a);                                       \
+    const VEC vb = PFX##_loadu_##SFX(b);                                       \
+    const VEC vz = PFX##_##OP##_##SFX(va, vb);                                 \
+    PFX##_storeu_##SFX(res, vz);                                               \
+    thread_state_t *state = _get_thread_state();                               \
+    if (__builtin_expect(state->checking_disabled, 0)) {                       \
+      return;                                                                  \
+    }                                                                          \
+    _stats_add_operations(state, N);                                           \
+    if (__builtin_expect(sampling, 0) && _sample_skip(state, context)) {       \
+      return;                                                                  \
+    }                                                                          \
+    const uint32_t mask = _mask_##TYPE##_##N##_##ISA(                          \
+        va, vb, vz, _mask_threshold((cancellation_context_t *)context));       \
+    if (__builtin_expect(mask != 0, 0)) {                                      \
+      _cancell_lanes_##TYPE(a, b, res, mask, context);                         \
+    }                                                                          \
+  }
+
+/* Kernel on N lanes made of two kernels on N/2 lanes */
+#define define_packed_split(OP, TYPE, N, HALF, ISA)                            \
+  __attribute__((target(#ISA))) static void _##OP##_##TYPE##_##N##_##ISA(      \
+      const TYPE *a, const TYPE *b, TYPE *res, void *context) {                \
+    _##OP##_##TYPE##_##HALF##_##ISA(a, b, res, context);                       \
+    _##OP##_##TYPE##_##HALF##_##ISA(a + HALF, b + HALF, res + HALF, context);  \
+  }
+
+#define define_packed_resolver_avx2(OP, TYPE, N)                               \
+  static packed_##TYPE##_op_t _resolve_##OP##_##TYPE##_##N(void) {             \
+    __builtin_cpu_init();                                                      \
+    if (__builtin_cpu_supports("avx2")) {                                      \
+      return _##OP##_##TYPE##_##N##_avx2;                                      \
+    }                                                                          \
+    return _##OP##_##TYPE##_##N##_scalar;                                      \
+  }
+
+#define define_packed_resolver_avx512f(OP, TYPE, N)                            \
+  static packed_##TYPE##_op_t _resolve_##OP##_##TYPE##_##N(void) {             \
+    __builtin_cpu_init();                                                      \
+    if (__builtin_cpu_supports("avx512f")) {                                   \
+      return _##OP##_##TYPE##_##N##_avx512f;                                   \
+    }                                                                          \
+    if (__builtin_cpu_supports("avx2")) {                                      \
+      return _##OP##_##TYPE##_##N##_avx2;                                      \
+    }                                                                          \
+    return _##OP##_##TYPE##_##N##_scalar;                                      \
+  }
+
+#define define_packed_export(OP, TYPE, N)                                      \
+  void INTERFLOP_CANCELLATION_API(OP##_##TYPE##_##N)(                          \
+      const TYPE *a, const TYPE *b, TYPE *res, void *context)                  \
+      __attribute__((ifunc("_resolve_" #OP "_" #TYPE "_" #N)))
+
+#define define_packed_avx2(OP, TYPE, N, VEC, PFX, SFX)                         \
+  define_packed_scalar(OP, TYPE, N)                                            \
+  define_packed_simd(OP, TYPE, N, avx2, VEC, PFX, SFX)                         \
+  define_packed_resolver_avx2(OP, TYPE, N)                                     \
+  define_packed_export(OP, TYPE, N)
+
+#define define_packed_avx512f(OP, TYPE, N, HALF, VEC, PFX, SFX)                \
+  define_packed_scalar(OP, TYPE, N)                                            \
+  define_packed_split(OP, TYPE, N, HALF, avx2)                                 \
+  define_packed_simd(OP, TYPE, N, avx512f, VEC, PFX, SFX)                      \
+  define_packed_resolver_avx512f(OP, TYPE, N)                                  \
+  define_packed_export(OP, TYPE, N)
+
+#else /* !__x86_64__ */
+
+#define define_packed_export(OP, TYPE, N)                                      \
+  void INTERFLOP_CANCELLATION_API(OP##_##TYPE##_##N)(                          \
+      const TYPE *a, const TYPE *b, TYPE *res, void *context) {                \
+    _##OP##_##TYPE##_##N##_scalar(a, b, res, context);                         \
+  }
+
+#define define_packed_avx2(OP, TYPE, N, VEC, PFX, SFX)                         \
+  define_packed_scalar(OP, TYPE, N)                                            \
+  define_packed_export(OP, TYPE, N)
+
+#define define_packed_avx512f(OP, TYPE, N, HALF, VEC, PFX, SFX)                \
+  define_packed_scalar(OP, TYPE, N)                                            \
+  define_packed_export(OP, TYPE, N)
+
+#endif /* __x86_64__ */
+
+define_packed_avx2(add, double, 2, __m128d, _mm, pd);
+define_packed_avx2(sub, double, 2, __m128d, _mm, pd);
+define_packed_avx2(add, double, 4, __m256d, _mm256, pd);
+define_packed_avx2(sub, double, 4, __m256d, _mm256, pd);
+define_packed_avx512f(add, double, 8, 4, __m512d, _mm512, pd);
+define_packed_avx512f(sub, double, 8, 4, __m512d, _mm512, pd);
+define_packed_avx2(add, float, 4, __m128, _mm, ps);
+define_packed_avx2(sub, float, 4, __m128, _mm, ps);
+define_packed_avx2(add, float, 8, __m256, _mm256, ps);
+define_packed_avx2(sub, float, 8, __m256, _mm256, ps);
+define_packed_avx512f(add, float, 16, 8, __m512, _mm512, ps);
+define_packed_avx512f(sub, float, 16, 8, __m512, _mm512, ps);
+
+/* Array operations: the lanes are processed in groups of ARRAY_LANES. The
+ * results and the cancellation test of a group are computed by fixed-length
+ * loops that the compiler vectorizes, even with the cost model of -O2. The
+ * groups with cancellations are scanned again, and the random factors of the
+ * noises of all their cancelled lanes are drawn at once, then scaled lane by
+ * lane */
+
+/* Number of lanes per group */
+#define ARRAY_LANES 8
+
+/* context of the loaded backend, used by the array operations that are
+ * called outside of the interflop interface */
+static cancellation_context_t *backend_context = NULL;
+
+/* Returns non-zero if one of the n lanes of res = a op b cancels by at least
+ * threshold */
+#define define_array_hits(TYPE)                                                \
+  static inline int32_t _array_hits_##TYPE(const TYPE *a, const TYPE *b,       \
+                                           const TYPE *res, const int n,       \
+                                           const int threshold) {              \
+    int32_t hits = 0;                                                          \
+    for (int i = 0; i < n; i++) {                                              \
+      const int32_t e_a = BIASED_EXPONENT(a[i]);                               \
+      const int32_t e_b = BIASED_EXPONENT(b[i]);                               \
+      const int32_t e_res = BIASED_EXPONENT(res[i]);                           \
+      hits |= !_no_cancellation(e_a, e_b, e_res, threshold);                   \
+    }                                                                          \
+    return hits;                                                               \
+  }
+
+/* Records the cancellations of the n lanes of res = a op b and adds the
+ * noises to res */
+#define define_array_cancell(TYPE)                                             \
+  static void _array_cancell_##TYPE(thread_state_t *state, const TYPE *a,      \
+                                    const TYPE *b, TYPE *res, const int n,     \
+                                    const cancellation_context_t *ctx) {       \
+    int32_t index[ARRAY_LANES], exp[ARRAY_LANES];                              \
+    const int tolerance = _thread_tolerance(state, ctx);                       \
+    int noises = 0;                                                            \
+    for (int i = 0; i < n; i++) {                                              \
+      int32_t e_z = 0;                                                         \
+      const int cancellation = CANCELLATION_SIZE(a[i], b[i], res[i], &e_z);    \
+      if (ctx->histogram_file != NULL && cancellation >= 0) {                  \
+        _histogram_add(state, PRECISION(res[i]), cancellation);                \
+      }                                                                        \
+      if (cancellation >= tolerance) {                                         \
+        _record_cancellation(state, cancellation, ctx);                        \
+        UNDERFLOW_RECORD(state, res[i], e_z - (cancellation - 1), ctx);        \
+        if (trace_fd >= 0) {                                                   \
+          _trace_add(state, cancellation_trace_op_add_sub, sizeof(TYPE) * 8,   \
+                     cancellation, TRACE_EXPONENT(a[i]),                       \
+                     TRACE_EXPONENT(b[i]));                                    \
+        }                                                                      \
+        if (ctx->mode == cancellation_mode_detect) {                           \
+          continue;                                                            \
+        }                                                                      \
+        if (__builtin_expect(ctx->samples > 1, 0)) {                           \
+          _Generic(res[0],                                                     \
+              float: _multi_sample_binary32,                                   \
+              double: _multi_sample_binary64)(                                 \
+              cancellation, e_z - (cancellation - 1), &res[i], ctx);           \
+          _stats_add_noises(state, 1);                                         \
+          continue;                                                            \
+        }                                                                      \
+        index[noises] = i;                                                     \
+        exp[noises] = e_z - (cancellation - 1);                                \
+        noises++;                                                              \
+      }                                                                        \
+    }                                                                          \
+    if (noises == 0) {                                                         \
+      return;                                                                  \
+    }                                                                          \
+    _stats_add_noises(state, noises);                                          \
+    if (ctx->noise == cancellation_noise_truncate) {                           \
+      for (int i = 0; i < noises; i++) {                                       \
+        _Generic(res[0], float: perturb_binary32, double: perturb_binary64)(   \
+            &res[index[i]], exp[i], ctx);                                      \
+      }                                                                        \
+      return;                                                                  \
+    }                                                                          \
+    TYPE rand[ARRAY_LANES];                                                    \
+    _Generic(res[0],                                                           \
+        float: _noise_fill_binary32,                                           \
+        double: _noise_fill_binary64)(rand, noises, ctx);                      \
+    for (int i = 0; i < noises; i++) {                                         \
+      res[index[i]] = _Generic(res[0],                                         \
+          float: _add_noise_binary32,                                          \
+          double: _add_noise_binary64)(res[index[i]], rand[i], exp[i]);        \
+    }                                                                          \
+  }
+
+define_array_hits(float);
+define_array_hits(double);
+define_array_cancell(float);
+define_array_cancell(double);
+
+/* The results of a group are computed in a local buffer, so that res can be
+ * a or b. The full groups call the lanes function with the constant
+ * ARRAY_LANES, which gives fixed-length loops once inlined */
+#define define_array_op(NAME, TYPE, OP)                                        \
+  static inline void _##NAME##_lanes(                                          \
+      thread_state_t *state, const TYPE *a, const TYPE *b, TYPE *res,          \
+      const int n, const int threshold, const cancellation_context_t *ctx) {   \
+    TYPE r[ARRAY_LANES];                                                       \
+    for (int i = 0; i < n; i++) {                                              \
+      r[i] = a[i] OP b[i];                                                     \
+    }                                                                          \
+    if (__builtin_expect(_array_hits_##TYPE(a, b, r, n, threshold) != 0, 0)) { \
+      _array_cancell_##TYPE(state, a, b, r, n, ctx);                           \
+    }                                                                          \
+    for (int i = 0; i < n; i++) {                                              \
+      res[i] = r[i];                                                           \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  void NAME(const TYPE *a, const TYPE *b, TYPE *res, size_t n) {               \
+    const cancellation_context_t *ctx = backend_context;                       \
+    thread_state_t *state = _get_thread_state();                               \
+    _mpi_poll(state);                                                          \
+    if (ctx == NULL || state->checking_disabled) {                             \
+      for (size_t i = 0; i < n; i++) {                                         \
+        res[i] = a[i] OP b[i];                                                 \
+      }                                                                        \
+      return;                                                                  \
+    }                                                                          \
+    _stats_add_operations(state, n);                                           \
+    const int threshold = _mask_threshold(ctx);                                \
+    size_t i = 0;                                                              \
+    for (; i + ARRAY_LANES <= n; i += ARRAY_LANES) {                           \
+      _##NAME##_lanes(state, a + i, b + i, res + i, ARRAY_LANES, threshold,    \
+                      ctx);                                                    \
+    }                                                                          \
+    if (i < n) {                                                               \
+      _##NAME##_lanes(state, a + i, b + i, res + i, n - i, threshold, ctx);    \
+    }                                                                          \
+  }
+
+define_array_op(cancellation_add_array, double, +);
+define_array_op(cancellation_sub_array, double, -);
+define_array_op(cancellation_add_arrayf, float, +);
+define_array_op(cancellation_sub_arrayf, float, -);
+
+void INTERFLOP_CANCELLATION_API(enter_function)(
+    interflop_function_stack_t *stack, _u_ void *context, _u_ int nb_args,
+    _u_ va_list ap) {
+  thread_state_t *state = _get_thread_state();
+  _mpi_poll(state);
+  _function_enter(state, stack->array[stack->top]);
+}
+
+void INTERFLOP_CANCELLATION_API(exit_function)(
+    interflop_function_stack_t *stack, _u_ void *context, _u_ int nb_args,
+    _u_ va_list ap) {
+  thread_state_t *state = _get_thread_state();
+  _mpi_poll(state);
+  /* the exited function is still on top of the stack, switch to its caller */
+  _function_enter(state,
+                  (stack->top > 0) ? stack->array[stack->top - 1] : NULL);
+}
+
 #undef _u_
+
+/* keys of the long-only options */
+typedef enum {
+  KEY_WARNING_MODE = 0x100,
+  KEY_WARNING_SAMPLE_RATE,
+  KEY_WARNING_MAX_LINES,
+  KEY_WARNING_PERIOD,
+  KEY_HISTOGRAM,
+  KEY_HISTOGRAM_FORMAT,
+  KEY_TOP_FUNCTIONS,
+  KEY_SAMPLE_PERIOD,
+  KEY_SAMPLE_RATE,
+  KEY_MODE,
+  KEY_THREAD_STORAGE,
+  KEY_PRECISION_LOSS,
+  KEY_TRACE,
+  KEY_STATS,
+  KEY_TOLERANCE_FILE,
+  KEY_SAMPLES,
+  KEY_MPI_REDUCE,
+  KEY_NOISE,
+} key_args;
+
 static struct argp_option options[] = {
     {"tolerance", 't', "TOLERANCE", 0, "Select tolerance (TOLERANCE >= 0)", 0},
+    {"tolerance-file", KEY_TOLERANCE_FILE, "FILE", 0,
+     "Read per-function tolerances from FILE, one \"function tolerance\" or "
+     "\"function exclude\" line per function",
+     0},
+    {"mode", KEY_MODE, "MODE", 0,
+     "Select what is done on a cancellation: mca (record it and add a noise, "
+     "default) or detect (only record it)",
+     0},
+    {"noise", KEY_NOISE, "NOISE", 0,
+     "Select how results are perturbed in mca mode: uniform (a random noise "
+     "of the magnitude of the cancelled bits, default), sign (a noise of "
+     "that magnitude and of random sign) or truncate (the cancelled bits are "
+     "cleared)",
+     0},
+    {"samples", KEY_SAMPLES, "K", 0,
+     "Compute K perturbed results per cancellation in mca mode and report "
+     "their spread at exit (1 <= K <= 8, experimental)",
+     0},
     {"warning", 'w', "WARNING", 0, "Enable warning for cancellations", 0},
+    {"warning-mode", KEY_WARNING_MODE, "MODE", 0,
+     "Select how warnings are reported: immediate (one line per "
+     "cancellation, default) or buffered (counts per cancellation size)",
+     0},
+    {"warning-sample-rate", KEY_WARNING_SAMPLE_RATE, "RATE", 0,
+     "Report one cancellation out of RATE in immediate mode (RATE >= 1)", 0},
+    {"warning-max-lines", KEY_WARNING_MAX_LINES, "LINES", 0,
+     "Stop reporting after LINES lines (0 for unlimited), the buffered totals "
+     "are always reported at exit",
+     0},
+    {"warning-period", KEY_WARNING_PERIOD, "EVENTS", 0,
+     "Report the buffered counts since the previous report every EVENTS "
+     "cancellations per thread (0 to report at exit only)",
+     0},
+    {"histogram", KEY_HISTOGRAM, "FILE", 0,
+     "Write the histogram of cancellation sizes to FILE at exit", 0},
+    {"histogram-format", KEY_HISTOGRAM_FORMAT, "FORMAT", 0,
+     "Select the histogram format: csv (default) or json", 0},
+    {"trace", KEY_TRACE, "FILE", 0,
+     "Write each cancellation larger than the tolerance as a binary record "
+     "to FILE",
+     0},
+    {"stats", KEY_STATS, 0, 0,
+     "Publish live counters in a shared-memory segment, read with "
+     "cancellation_stats",
+     0},
+    {"top-functions", KEY_TOP_FUNCTIONS, "N", 0,
+     "Report the N functions with the most cancellations at exit, requires "
+     "function instrumentation (0 to disable)",
+     0},
+    {"mpi-reduce", KEY_MPI_REDUCE, 0, 0,
+     "Merge the histograms and the top functions of all the MPI ranks into a "
+     "single report written by rank 0",
+     0},
+    {"precision-loss", KEY_PRECISION_LOSS, 0, 0,
+     "Count the comparisons of nearly-equal operands and the inexact double "
+     "to float casts, reported at exit",
+     0},
+    {"sample-period", KEY_SAMPLE_PERIOD, "PERIOD", 0,
+     "Check one addition, subtraction or FMA out of PERIOD per thread "
+     "(PERIOD >= 1)",
+     0},
+    {"sample-rate", KEY_SAMPLE_RATE, "RATE", 0,
+     "Check a random subset of the additions, subtractions and FMAs, of mean "
+     "fraction RATE (0 < RATE <= 1), overrides --sample-period",
+     0},
+    {"thread-storage", KEY_THREAD_STORAGE, "STORAGE", 0,
+     "Select where the per-thread states are stored: tls (default) or table "
+     "(looked up with a thread-specific key, for Valgrind tools)",
+     0},
     {"seed", 's', "SEED", 0, "Fix the random generator seed", 0},
     {0}};
 
@@ -217,6 +4018,166 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
   case 'w':
     _set_cancellation_warning(true, ctx);
     break;
+  case KEY_MODE:
+    /* mode */
+    for (int mode = 0; mode < _cancellation_mode_end_; mode++) {
+      if (interflop_strcasecmp(CANCELLATION_MODE_STR[mode], arg) == 0) {
+        _set_cancellation_mode(mode, ctx);
+        return 0;
+      }
+    }
+    logger_error("--mode invalid value provided, must be one of: "
+                 "{mca, detect}.");
+    break;
+  case KEY_NOISE:
+    /* noise */
+    for (int noise = 0; noise < _cancellation_noise_end_; noise++) {
+      if (interflop_strcasecmp(CANCELLATION_NOISE_STR[noise], arg) == 0) {
+        _set_cancellation_noise(noise, ctx);
+        return 0;
+      }
+    }
+    logger_error("--noise invalid value provided, must be one of: "
+                 "{uniform, sign, truncate}.");
+    break;
+  case KEY_SAMPLES:
+    /* samples */
+    error = 0;
+    long samples = interflop_strtol(arg, &endptr, &error);
+    if (error != 0 || samples < 1 || samples > CANCELLATION_SAMPLES_MAX) {
+      logger_error("--samples invalid value provided, must be an integer "
+                   "between 1 and %d.",
+                   CANCELLATION_SAMPLES_MAX);
+    } else {
+      _set_cancellation_samples(samples, ctx);
+    }
+    break;
+  case KEY_PRECISION_LOSS:
+    _set_cancellation_precision_loss(true, ctx);
+    break;
+  case KEY_MPI_REDUCE:
+    _set_cancellation_mpi_reduce(true, ctx);
+    break;
+  case KEY_THREAD_STORAGE:
+    /* thread storage */
+    for (int storage = 0; storage < _cancellation_thread_storage_end_;
+         storage++) {
+      if (interflop_strcasecmp(CANCELLATION_THREAD_STORAGE_STR[storage],
+                               arg) == 0) {
+        _set_cancellation_thread_storage(storage, ctx);
+        return 0;
+      }
+    }
+    logger_error("--thread-storage invalid value provided, must be one of: "
+                 "{tls, table}.");
+    break;
+  case KEY_WARNING_MODE:
+    /* warning mode */
+    for (int mode = 0; mode < _cancellation_warning_mode_end_; mode++) {
+      if (interflop_strcasecmp(CANCELLATION_WARNING_MODE_STR[mode], arg) ==
+          0) {
+        _set_cancellation_warning_mode(mode, ctx);
+        return 0;
+      }
+    }
+    logger_error("--warning-mode invalid value provided, must be one of: "
+                 "{immediate, buffered}.");
+    break;
+  case KEY_WARNING_SAMPLE_RATE:
+    /* warning sample rate */
+    error = 0;
+    int rate = interflop_strtol(arg, &endptr, &error);
+    if (error != 0 || rate < 1) {
+      logger_error("--warning-sample-rate invalid value provided, must be a "
+                   "strictly positive integer.");
+    } else {
+      _set_cancellation_warning_sample_rate(rate, ctx);
+    }
+    break;
+  case KEY_WARNING_MAX_LINES:
+    /* warning max lines */
+    error = 0;
+    long lines = interflop_strtol(arg, &endptr, &error);
+    if (error != 0 || lines < 0) {
+      logger_error("--warning-max-lines invalid value provided, must be a "
+                   "positive integer.");
+    } else {
+      _set_cancellation_warning_max_lines(lines, ctx);
+    }
+    break;
+  case KEY_WARNING_PERIOD:
+    /* warning period */
+    error = 0;
+    long period = interflop_strtol(arg, &endptr, &error);
+    if (error != 0 || period < 0) {
+      logger_error("--warning-period invalid value provided, must be a "
+                   "positive integer.");
+    } else {
+      _set_cancellation_warning_period(period, ctx);
+    }
+    break;
+  case KEY_STATS:
+    _set_cancellation_stats(true, ctx);
+    break;
+  case KEY_TOLERANCE_FILE:
+    /* tolerance file */
+    _set_cancellation_tolerance_file(arg, ctx);
+    break;
+  case KEY_TRACE:
+    /* trace file */
+    _set_cancellation_trace_file(arg, ctx);
+    break;
+  case KEY_HISTOGRAM:
+    /* histogram file */
+    _set_cancellation_histogram_file(arg, ctx);
+    break;
+  case KEY_HISTOGRAM_FORMAT:
+    /* histogram format */
+    for (int format = 0; format < _cancellation_histogram_format_end_;
+         format++) {
+      if (interflop_strcasecmp(CANCELLATION_HISTOGRAM_FORMAT_STR[format],
+                               arg) == 0) {
+        _set_cancellation_histogram_format(format, ctx);
+        return 0;
+      }
+    }
+    logger_error("--histogram-format invalid value provided, must be one of: "
+                 "{csv, json}.");
+    break;
+  case KEY_TOP_FUNCTIONS:
+    /* top functions */
+    error = 0;
+    int top_functions = interflop_strtol(arg, &endptr, &error);
+    if (error != 0 || top_functions < 0) {
+      logger_error("--top-functions invalid value provided, must be a "
+                   "positive integer.");
+    } else {
+      _set_cancellation_top_functions(top_functions, ctx);
+    }
+    break;
+  case KEY_SAMPLE_PERIOD:
+    /* sample period */
+    error = 0;
+    long sample_period = interflop_strtol(arg, &endptr, &error);
+    if (error != 0 || sample_period < 1) {
+      logger_error("--sample-period invalid value provided, must be a "
+                   "strictly positive integer.");
+    } else {
+      _set_cancellation_sample_period(sample_period, ctx);
+    }
+    break;
+  case KEY_SAMPLE_RATE:
+    /* sample rate */
+    CHECK_IMPL(strtod);
+    error = 0;
+    double sample_rate = interflop_strtod(arg, &endptr, &error);
+    if (error != 0 || sample_rate <= 0 || sample_rate > 1) {
+      logger_error("--sample-rate invalid value provided, must be a "
+                   "number in (0, 1].");
+    } else {
+      _set_cancellation_sample_rate(sample_rate, ctx);
+    }
+    break;
   case 's':
     error = 0;
     seed = interflop_strtol(arg, &endptr, &error);
@@ -236,6 +4197,7 @@ static struct argp argp = {options, parse_opt, "", "", NULL, NULL, NULL};
 void INTERFLOP_CANCELLATION_API(CLI)(int argc, char **argv, void *context) {
   /* parse backend arguments */
   cancellation_context_t *ctx = (cancellation_context_t *)context;
+  _stdlib_once();
   if (interflop_argp_parse != NULL) {
     interflop_argp_parse(&argp, argc, argv, 0, 0, ctx);
   } else {
@@ -249,7 +4211,25 @@ void INTERFLOP_CANCELLATION_API(configure)(cancellation_conf_t conf,
                                            void *context) {
   cancellation_context_t *ctx = (cancellation_context_t *)context;
   _set_cancellation_tolerance(conf.tolerance, ctx);
+  _set_cancellation_tolerance_file(conf.tolerance_file, ctx);
   _set_cancellation_warning(conf.warning, ctx);
+  _set_cancellation_warning_mode(conf.warning_mode, ctx);
+  _set_cancellation_warning_sample_rate(conf.warning_sample_rate, ctx);
+  _set_cancellation_warning_max_lines(conf.warning_max_lines, ctx);
+  _set_cancellation_warning_period(conf.warning_period, ctx);
+  _set_cancellation_histogram_file(conf.histogram_file, ctx);
+  _set_cancellation_histogram_format(conf.histogram_format, ctx);
+  _set_cancellation_trace_file(conf.trace_file, ctx);
+  _set_cancellation_stats(conf.stats, ctx);
+  _set_cancellation_top_functions(conf.top_functions, ctx);
+  _set_cancellation_mpi_reduce(conf.mpi_reduce, ctx);
+  _set_cancellation_sample_period(conf.sample_period, ctx);
+  _set_cancellation_sample_rate(conf.sample_rate, ctx);
+  _set_cancellation_mode(conf.mode, ctx);
+  _set_cancellation_noise(conf.noise, ctx);
+  _set_cancellation_samples(conf.samples, ctx);
+  _set_cancellation_thread_storage(conf.thread_storage, ctx);
+  _set_cancellation_precision_loss(conf.precision_loss, ctx);
   _set_cancellation_seed(conf.seed, ctx);
 }
 
@@ -258,74 +4238,288 @@ static void init_context(cancellation_context_t *ctx) {
   ctx->seed = CANCELLATION_SEED_DEFAULT;
   ctx->warning = CANCELLATION_WARNING_DEFAULT;
   ctx->tolerance = CANCELLATION_TOLERANCE_DEFAULT;
+  ctx->tolerance_file = CANCELLATION_TOLERANCE_FILE_DEFAULT;
+  ctx->warning_mode = CANCELLATION_WARNING_MODE_DEFAULT;
+  ctx->warning_sample_rate = CANCELLATION_WARNING_SAMPLE_RATE_DEFAULT;
+  ctx->warning_max_lines = CANCELLATION_WARNING_MAX_LINES_DEFAULT;
+  ctx->warning_period = CANCELLATION_WARNING_PERIOD_DEFAULT;
+  ctx->histogram_file = CANCELLATION_HISTOGRAM_FILE_DEFAULT;
+  ctx->histogram_format = CANCELLATION_HISTOGRAM_FORMAT_DEFAULT;
+  ctx->trace_file = CANCELLATION_TRACE_FILE_DEFAULT;
+  ctx->stats = CANCELLATION_STATS_DEFAULT;
+  ctx->top_functions = CANCELLATION_TOP_FUNCTIONS_DEFAULT;
+  ctx->mpi_reduce = CANCELLATION_MPI_REDUCE_DEFAULT;
+  ctx->sample_period = CANCELLATION_SAMPLE_PERIOD_DEFAULT;
+  ctx->sample_rate = CANCELLATION_SAMPLE_RATE_DEFAULT;
+  ctx->mode = CANCELLATION_MODE_DEFAULT;
+  ctx->noise = CANCELLATION_NOISE_DEFAULT;
+  ctx->samples = CANCELLATION_SAMPLES_DEFAULT;
+  ctx->thread_storage = CANCELLATION_THREAD_STORAGE_DEFAULT;
+  ctx->precision_loss = CANCELLATION_PRECISION_LOSS_DEFAULT;
 }
 
-#define CHECK_IMPL(name)                                                       \
-  if (interflop_##name == Null) {                                              \
-    interflop_panic("Interflop backend error: " #name " not implemented\n");   \
+void INTERFLOP_CANCELLATION_API(finalize)(void *context) {
+  cancellation_context_t *ctx = (cancellation_context_t *)context;
+  if (ctx->warning && ctx->warning_mode == cancellation_warning_mode_buffered) {
+    report_buffer_t *buffer =
+        __atomic_load_n(&report_buffers, __ATOMIC_ACQUIRE);
+    for (; buffer != NULL; buffer = buffer->next) {
+      _report_merge(buffer);
+    }
+    _report_write_totals();
+  }
+  /* with --mpi-reduce, the reports are written by rank 0 in MPI_Finalize */
+  if (ctx->histogram_file != NULL && !mpi_reported) {
+    _histogram_write(ctx);
+  }
+  if (ctx->top_functions != 0 && !mpi_reported) {
+    _function_report(ctx);
+  }
+  if (ctx->trace_file != NULL) {
+    _trace_write_functions(ctx);
+  }
+  if (stats_segment != NULL) {
+    _stats_close();
+  }
+  if (ctx->precision_loss) {
+    _precision_loss_report();
+  }
+  if (ctx->samples > 1) {
+    _spread_report(ctx);
   }
+  if (underflows != NULL) {
+    _underflow_report();
+  }
+#ifdef SELF_PROFILING
+  _profile_report(CALLBACKS_STR[callbacks]);
+#endif
+}
 
-void _cancellation_check_stdlib(void) {
-  CHECK_IMPL(malloc);
-  CHECK_IMPL(exit);
-  CHECK_IMPL(fopen);
-  CHECK_IMPL(fprintf);
-  CHECK_IMPL(getenv);
-  CHECK_IMPL(gettid);
-  CHECK_IMPL(sprintf);
-  CHECK_IMPL(strcasecmp);
-  CHECK_IMPL(strerror);
-  CHECK_IMPL(vfprintf);
-  CHECK_IMPL(vwarnx);
+/* Commands of the user calls with the INTERFLOP_CUSTOM_ID id */
+typedef enum {
+  cancellation_call_start,
+  cancellation_call_stop,
+  cancellation_call_set_tolerance,
+  cancellation_call_set_thread_index,
+  _cancellation_call_end_
+} cancellation_call_t;
+
+static const char *CANCELLATION_CALL_STR[] = {
+    "cancellation_start", "cancellation_stop", "cancellation_set_tolerance",
+    "cancellation_set_thread_index"};
+
+void INTERFLOP_CANCELLATION_API(user_call)(void *context, interflop_call_id id,
+                                           va_list ap) {
+  if (id != INTERFLOP_CUSTOM_ID) {
+    logger_warning("Unknown interflop_call id (=%d)\n", id);
+    return;
+  }
+  _mpi_poll(_get_thread_state());
+  const char *command = va_arg(ap, const char *);
+  cancellation_call_t call = 0;
+  for (; call < _cancellation_call_end_; call++) {
+    if (interflop_strcasecmp(CANCELLATION_CALL_STR[call], command) == 0) {
+      break;
+    }
+  }
+  switch (call) {
+  case cancellation_call_start:
+    _get_thread_state()->checking_disabled = false;
+    break;
+  case cancellation_call_stop:
+    _get_thread_state()->checking_disabled = true;
+    break;
+  case cancellation_call_set_tolerance: {
+    const int tolerance = va_arg(ap, int);
+    if (callbacks == callbacks_fast && tolerance < 1) {
+      logger_warning("cancellation_set_tolerance: the callbacks selected at "
+                     "init do not check cancellations of size below 1\n");
+    }
+    _set_cancellation_tolerance(tolerance, context);
+    break;
+  }
+  case cancellation_call_set_thread_index: {
+    /* the generator of the thread is reseeded on its next draw */
+    thread_state_t *state = _get_thread_state();
+    state->thread_index = va_arg(ap, int);
+    state->thread_index_is_set = true;
+    state->rng_ring.is_init = false;
+    state->rng_ring.remaining = 0;
+    state->rng_ring.remaining_binary32 = 0;
+    state->rng_ring.remaining_signs = 0;
+    break;
+  }
+  default:
+    logger_warning("Unknown interflop_call command (=%s)\n", command);
+    break;
+  }
 }
 
 void INTERFLOP_CANCELLATION_API(pre_init)(File *stream, interflop_panic_t panic,
                                           void **context) {
   interflop_set_handler("panic", panic);
-  _cancellation_check_stdlib();
 
-  /* Initialize the logger */
-  logger_init(stream);
+  /* the logger is initialized on its first message */
+  logger_stream = stream;
 
-  /* allocate the context */
-  cancellation_context_t *ctx = (cancellation_context_t *)interflop_malloc(
+  /* before any per-thread state is looked up */
+  pthread_once(&thread_key_once, _thread_key_create);
+
+  /* one context per call, a backend may be loaded twice with different
+   * options */
+  cancellation_context_t *ctx = (cancellation_context_t *)_arena_alloc(
       sizeof(cancellation_context_t));
   init_context(ctx);
   *context = ctx;
 }
 
+#ifdef SELF_PROFILING
+/* callbacks selected at init, called by the profiling wrappers */
+static struct interflop_backend_interface_t profile_targets;
+
+#define define_profile_op(NAME, TYPE)                                          \
+  static void _profile_##NAME(TYPE a, TYPE b, TYPE *res, void *context) {      \
+    profile_call(profile_##NAME,                                               \
+                 profile_targets.interflop_##NAME(a, b, res, context));        \
+  }
+
+#define define_profile_fma(NAME, TYPE)                                         \
+  static void _profile_##NAME(TYPE a, TYPE b, TYPE c, TYPE *res,               \
+                              void *context) {                                 \
+    profile_call(profile_##NAME,                                               \
+                 profile_targets.interflop_##NAME(a, b, c, res, context));     \
+  }
+
+define_profile_op(add_float, float);
+define_profile_op(sub_float, float);
+define_profile_op(mul_float, float);
+define_profile_op(div_float, float);
+define_profile_op(add_double, double);
+define_profile_op(sub_double, double);
+define_profile_op(mul_double, double);
+define_profile_op(div_double, double);
+define_profile_fma(fma_float, float);
+define_profile_fma(fma_double, double);
+
+/* Replaces the callbacks of interface by their profiling wrappers */
+static void _profile_wrap(struct interflop_backend_interface_t *interface) {
+  profile_targets = *interface;
+  interface->interflop_add_float = _profile_add_float;
+  interface->interflop_sub_float = _profile_sub_float;
+  interface->interflop_mul_float = _profile_mul_float;
+  interface->interflop_div_float = _profile_div_float;
+  interface->interflop_add_double = _profile_add_double;
+  interface->interflop_sub_double = _profile_sub_double;
+  interface->interflop_mul_double = _profile_mul_double;
+  interface->interflop_div_double = _profile_div_double;
+  interface->interflop_fma_float = _profile_fma_float;
+  interface->interflop_fma_double = _profile_fma_double;
+}
+#endif
+
 struct interflop_backend_interface_t
 INTERFLOP_CANCELLATION_API(init)(void *context) {
   cancellation_context_t *ctx = (cancellation_context_t *)context;
-  logger_info("interflop_cancellation: loaded backend with tolerance = %d\n",
-              ctx->tolerance);
+  _stdlib_once();
+  _cancellation_check_stdlib_options(ctx);
+  /* the loading message is most of the startup time of a process that logs
+   * nothing else, it is disabled as in the other backends */
+  const char *silent_load = interflop_getenv("VFC_BACKENDS_SILENT_LOAD");
+  if (silent_load == NULL || interflop_strcasecmp(silent_load, "True") != 0) {
+    logger_info("interflop_cancellation: loaded backend with tolerance = "
+                "%d\n",
+                ctx->tolerance);
+  }
+
+#ifdef RNG_THREAD_SAFE
+  /* selected before any per-thread state is accessed from init */
+  thread_storage_table =
+      ctx->thread_storage == cancellation_thread_storage_table;
+#endif
+
+  _sample_init(ctx);
+  perturb_binary32 = PERTURB_BINARY32[ctx->noise];
+  perturb_binary64 = PERTURB_BINARY64[ctx->noise];
+  /* loaded once the options are parsed, before any function is entered */
+  if (ctx->tolerance_file != NULL) {
+    _function_tolerances_load(ctx);
+  }
+  /* the fast callbacks only know the tolerance of the context */
+  if (ctx->mpi_reduce) {
+    _mpi_init(ctx);
+  }
+  mpi_per_operation_state = sampling || ctx->stats;
+  per_operation_state = mpi_per_operation_state || mpi_main_state != NULL;
+  if (ctx->histogram_file == NULL && ctx->tolerance_file == NULL &&
+      !ctx->stats && mpi_main_state == NULL) {
+    callbacks = sampling                ? callbacks_sampled
+                : (ctx->tolerance == 1) ? callbacks_fast
+                                        : callbacks_tolerance;
+  }
+  if (ctx->trace_file != NULL) {
+    _trace_open(ctx);
+  }
+  if (ctx->stats) {
+    _stats_open();
+  }
+  /* the functions are tracked for their report, for the trace and for their
+   * tolerances */
+  const bool track_functions = ctx->top_functions != 0 ||
+                               ctx->trace_file != NULL ||
+                               ctx->tolerance_file != NULL;
 
   struct interflop_backend_interface_t interflop_backend_cancellation = {
-    interflop_add_float : INTERFLOP_CANCELLATION_API(add_float),
-    interflop_sub_float : INTERFLOP_CANCELLATION_API(sub_float),
+    interflop_add_float : add_float_callbacks[callbacks],
+    interflop_sub_float : sub_float_callbacks[callbacks],
     interflop_mul_float : INTERFLOP_CANCELLATION_API(mul_float),
     interflop_div_float : INTERFLOP_CANCELLATION_API(div_float),
-    interflop_cmp_float : NULL,
-    interflop_add_double : INTERFLOP_CANCELLATION_API(add_double),
-    interflop_sub_double : INTERFLOP_CANCELLATION_API(sub_double),
+    interflop_cmp_float :
+        ctx->precision_loss ? _cmp_float_checked : NULL,
+    interflop_add_double : add_double_callbacks[callbacks],
+    interflop_sub_double : sub_double_callbacks[callbacks],
     interflop_mul_double : INTERFLOP_CANCELLATION_API(mul_double),
     interflop_div_double : INTERFLOP_CANCELLATION_API(div_double),
-    interflop_cmp_double : NULL,
+    interflop_cmp_double :
+        ctx->precision_loss ? _cmp_double_checked : NULL,
     interflop_cast_double_to_float :
-        INTERFLOP_CANCELLATION_API(cast_double_to_float),
-    interflop_fma_float : INTERFLOP_CANCELLATION_API(fma_float),
-    interflop_fma_double : INTERFLOP_CANCELLATION_API(fma_double),
-    interflop_enter_function : NULL,
-    interflop_exit_function : NULL,
-    interflop_user_call : NULL,
-    interflop_finalize : NULL
+        ctx->precision_loss ? _cast_double_to_float_checked
+                            : INTERFLOP_CANCELLATION_API(cast_double_to_float),
+    interflop_fma_float : fma_float_callbacks[callbacks],
+    interflop_fma_double : fma_double_callbacks[callbacks],
+    interflop_enter_function :
+        track_functions ? INTERFLOP_CANCELLATION_API(enter_function) : NULL,
+    interflop_exit_function :
+        track_functions ? INTERFLOP_CANCELLATION_API(exit_function) : NULL,
+    interflop_user_call : INTERFLOP_CANCELLATION_API(user_call),
+    interflop_finalize : INTERFLOP_CANCELLATION_API(finalize)
   };
 
   /* The seed for the RNG is initialized upon the first request for a random
      number */
 
-  _init_rng_state_struct(&rng_state, ctx->choose_seed,
-                         (unsigned long long int)(ctx->seed), false);
+  if (ctx->mode == cancellation_mode_detect) {
+    /* no noise is drawn, the RNG is only seeded lazily if sampling needs it */
+    if (!ctx->warning && ctx->histogram_file == NULL &&
+        ctx->top_functions == 0 && ctx->trace_file == NULL) {
+      logger_warning("--mode=detect records nothing without --warning, "
+                     "--histogram, --top-functions or --trace\n");
+    }
+    if (ctx->samples > 1) {
+      logger_warning("--samples is ignored with --mode=detect, which adds no "
+                     "noise\n");
+    }
+  } else if (ctx->noise == cancellation_noise_truncate && ctx->samples > 1) {
+    logger_warning("--samples is ignored with --noise=truncate, whose "
+                   "perturbations are all equal\n");
+    _set_cancellation_samples(1, ctx);
+  }
+
+  backend_context = ctx;
+
+#ifdef SELF_PROFILING
+  _profile_init();
+  _profile_wrap(&interflop_backend_cancellation);
+#endif
 
   return interflop_backend_cancellation;
 }
@@ -13,14 +13,87 @@
 #ifndef __INTERFLOP_CANCELLATION_H__
 #define __INTERFLOP_CANCELLATION_H__
 
+#include "interflop-stdlib/interflop.h"
 #include "interflop-stdlib/interflop_stdlib.h"
 
 #define INTERFLOP_CANCELLATION_API(name) interflop_cancellation_##name
 
 /* define default environment variables and default parameters */
 #define CANCELLATION_TOLERANCE_DEFAULT 1
+#define CANCELLATION_TOLERANCE_FILE_DEFAULT NULL
 #define CANCELLATION_WARNING_DEFAULT 0
 #define CANCELLATION_SEED_DEFAULT 0ULL
+#define CANCELLATION_WARNING_MODE_DEFAULT cancellation_warning_mode_immediate
+#define CANCELLATION_WARNING_SAMPLE_RATE_DEFAULT 1
+#define CANCELLATION_WARNING_MAX_LINES_DEFAULT 0
+#define CANCELLATION_WARNING_PERIOD_DEFAULT 0
+#define CANCELLATION_HISTOGRAM_FILE_DEFAULT NULL
+#define CANCELLATION_HISTOGRAM_FORMAT_DEFAULT cancellation_histogram_format_csv
+#define CANCELLATION_TRACE_FILE_DEFAULT NULL
+#define CANCELLATION_STATS_DEFAULT 0
+#define CANCELLATION_TOP_FUNCTIONS_DEFAULT 0
+#define CANCELLATION_SAMPLE_PERIOD_DEFAULT 1
+#define CANCELLATION_SAMPLE_RATE_DEFAULT 1.0
+#define CANCELLATION_MODE_DEFAULT cancellation_mode_mca
+#define CANCELLATION_NOISE_DEFAULT cancellation_noise_uniform
+#define CANCELLATION_THREAD_STORAGE_DEFAULT cancellation_thread_storage_tls
+#define CANCELLATION_PRECISION_LOSS_DEFAULT 0
+#define CANCELLATION_SAMPLES_DEFAULT 1
+#define CANCELLATION_MPI_REDUCE_DEFAULT 0
+/* Largest number of perturbed results per cancellation */
+#define CANCELLATION_SAMPLES_MAX 8
+
+/* How cancellation warnings are reported */
+typedef enum {
+  /* one line per detected cancellation */
+  cancellation_warning_mode_immediate,
+  /* events are counted per thread and reported periodically or at finalize */
+  cancellation_warning_mode_buffered,
+  _cancellation_warning_mode_end_
+} cancellation_warning_mode_t;
+
+/* What is done on a cancellation larger than the tolerance */
+typedef enum {
+  /* the cancellation is recorded and a noise is added to the result */
+  cancellation_mode_mca,
+  /* the cancellation is only recorded, results are left untouched */
+  cancellation_mode_detect,
+  _cancellation_mode_end_
+} cancellation_mode_t;
+
+/* How the result of a cancellation of size c and exponent e_z is perturbed
+ * in mca mode, with e_n = e_z - (c - 1) */
+typedef enum {
+  /* a random noise in [-0.5, 0.5) * 2^e_n */
+  cancellation_noise_uniform,
+  /* a noise of +/- 0.5 * 2^e_n, the bound of the uniform noises, of random
+   * sign: only one random bit is drawn per noise */
+  cancellation_noise_sign,
+  /* no noise, the bits of weight below 2^e_n are cleared: the result is
+   * rounded toward zero to a multiple of 2^e_n, deterministically */
+  cancellation_noise_truncate,
+  _cancellation_noise_end_
+} cancellation_noise_t;
+
+/* Where the per-thread states of the backend are stored */
+typedef enum {
+  /* in thread-local storage, the fastest when the backend is built with
+   * RNG_THREAD_SAFE */
+  cancellation_thread_storage_tls,
+  /* allocated per thread and looked up with a POSIX thread-specific key, for
+   * hosts where TLS accesses are costly or unavailable, like Valgrind tools.
+   * The state of an exited thread is reused. Builds without RNG_THREAD_SAFE
+   * always use it */
+  cancellation_thread_storage_table,
+  _cancellation_thread_storage_end_
+} cancellation_thread_storage_t;
+
+/* Output format of the histogram of cancellation sizes */
+typedef enum {
+  cancellation_histogram_format_csv,
+  cancellation_histogram_format_json,
+  _cancellation_histogram_format_end_
+} cancellation_histogram_format_t;
 
 /* Interflop context */
 typedef struct {
@@ -28,6 +101,51 @@ typedef struct {
   int tolerance;
   IBool choose_seed;
   IBool warning;
+  cancellation_warning_mode_t warning_mode;
+  /* report one event out of warning_sample_rate in immediate mode */
+  int warning_sample_rate;
+  /* maximum number of warning lines, 0 for unlimited. The totals written at
+   * finalize in buffered mode are not limited */
+  IUint64_t warning_max_lines;
+  /* flush the buffered events every warning_period events per thread and
+   * write the counts since the previous flush, 0 to only report at
+   * finalize */
+  IUint64_t warning_period;
+  /* file of per-function tolerances and exclusions, NULL to use tolerance
+   * everywhere */
+  const char *tolerance_file;
+  /* file where the histogram of cancellation sizes is written at finalize,
+   * NULL to disable the histogram */
+  const char *histogram_file;
+  cancellation_histogram_format_t histogram_format;
+  /* file where the cancellations are traced, NULL to disable the trace, see
+   * interflop_cancellation_trace.h */
+  const char *trace_file;
+  /* publish live counters in shared memory, see
+   * interflop_cancellation_stats.h */
+  IBool stats;
+  /* number of functions reported at finalize, ranked by number of
+   * cancellations, 0 to disable the attribution to functions */
+  int top_functions;
+  /* merge the histograms and the function tables of all the MPI ranks into
+   * a single report written by rank 0 */
+  IBool mpi_reduce;
+  /* check one addition, subtraction or FMA out of sample_period per
+   * thread */
+  IUint64_t sample_period;
+  /* check a random subset of the additions, subtractions and FMAs, of mean
+   * fraction sample_rate in (0, 1]; it overrides sample_period when below 1 */
+  double sample_rate;
+  cancellation_mode_t mode;
+  cancellation_noise_t noise;
+  /* number of perturbed results computed per cancellation in mca mode, one
+   * of them is kept and the spread of all of them is reported at finalize;
+   * 1 to only compute the kept one */
+  int samples;
+  cancellation_thread_storage_t thread_storage;
+  /* count the comparisons of nearly-equal operands and the inexact double to
+   * float casts, reported at finalize */
+  IBool precision_loss;
 } cancellation_context_t;
 
 typedef cancellation_context_t cancellation_conf_t;
@@ -55,11 +173,69 @@ void INTERFLOP_CANCELLATION_API(fma_float)(float a, float b, float c,
                                            float *res, void *context);
 void INTERFLOP_CANCELLATION_API(fma_double)(double a, double b, double c,
                                             double *res, void *context);
+void INTERFLOP_CANCELLATION_API(cmp_float)(enum FCMP_PREDICATE p, float a,
+                                           float b, int *res, void *context);
+void INTERFLOP_CANCELLATION_API(cmp_double)(enum FCMP_PREDICATE p, double a,
+                                            double b, int *res, void *context);
 void INTERFLOP_CANCELLATION_API(cast_double_to_float)(double a, float *b,
                                                       void *context);
+/* Packed additions and subtractions on N lanes, a, b and res point to N
+ * values and do not need to be aligned */
+void INTERFLOP_CANCELLATION_API(add_float_4)(const float *a, const float *b,
+                                             float *res, void *context);
+void INTERFLOP_CANCELLATION_API(sub_float_4)(const float *a, const float *b,
+                                             float *res, void *context);
+void INTERFLOP_CANCELLATION_API(add_float_8)(const float *a, const float *b,
+                                             float *res, void *context);
+void INTERFLOP_CANCELLATION_API(sub_float_8)(const float *a, const float *b,
+                                             float *res, void *context);
+void INTERFLOP_CANCELLATION_API(add_float_16)(const float *a, const float *b,
+                                              float *res, void *context);
+void INTERFLOP_CANCELLATION_API(sub_float_16)(const float *a, const float *b,
+                                              float *res, void *context);
+void INTERFLOP_CANCELLATION_API(add_double_2)(const double *a, const double *b,
+                                              double *res, void *context);
+void INTERFLOP_CANCELLATION_API(sub_double_2)(const double *a, const double *b,
+                                              double *res, void *context);
+void INTERFLOP_CANCELLATION_API(add_double_4)(const double *a, const double *b,
+                                              double *res, void *context);
+void INTERFLOP_CANCELLATION_API(sub_double_4)(const double *a, const double *b,
+                                              double *res, void *context);
+void INTERFLOP_CANCELLATION_API(add_double_8)(const double *a, const double *b,
+                                              double *res, void *context);
+void INTERFLOP_CANCELLATION_API(sub_double_8)(const double *a, const double *b,
+                                              double *res, void *context);
+/* Array additions and subtractions res[i] = a[i] +/- b[i] for i < n, checked
+ * with the context of the loaded backend. They can be called directly from
+ * hand-instrumented code. res may be a or b, but must not partially overlap
+ * them */
+void cancellation_add_array(const double *a, const double *b, double *res,
+                            size_t n);
+void cancellation_sub_array(const double *a, const double *b, double *res,
+                            size_t n);
+void cancellation_add_arrayf(const float *a, const float *b, float *res,
+                             size_t n);
+void cancellation_sub_arrayf(const float *a, const float *b, float *res,
+                             size_t n);
+void INTERFLOP_CANCELLATION_API(enter_function)(
+    interflop_function_stack_t *stack, void *context, int nb_args, va_list ap);
+void INTERFLOP_CANCELLATION_API(exit_function)(
+    interflop_function_stack_t *stack, void *context, int nb_args, va_list ap);
+/* User calls, with the INTERFLOP_CUSTOM_ID id followed by a command string:
+ * - "cancellation_start" and "cancellation_stop" switch the checking on and
+ *   off for the calling thread; threads start with the checking on
+ * - "cancellation_set_tolerance", followed by an int, changes the tolerance
+ *   for all threads
+ * - "cancellation_set_thread_index", followed by an int, sets the index of
+ *   the calling thread that selects its noise stream with --seed, by default
+ *   its position in the OpenMP teams or its order of first draw. Threads
+ *   started by the program must set it to draw reproducible noises */
+void INTERFLOP_CANCELLATION_API(user_call)(void *context, interflop_call_id id,
+                                           va_list ap);
 void INTERFLOP_CANCELLATION_API(configure)(cancellation_conf_t conf,
                                            void *context);
 void INTERFLOP_CANCELLATION_API(CLI)(int argc, char **argv, void *context);
+void INTERFLOP_CANCELLATION_API(finalize)(void *context);
 void INTERFLOP_CANCELLATION_API(pre_init)(File *stream, interflop_panic_t panic,
                                           void **context);
 struct interflop_backend_interface_t
@@ -0,0 +1,56 @@
+/*****************************************************************************\
+ *                                                                           *\
+ *  This file is part of the Verificarlo project,                            *\
+ *  under the Apache License v2.0 with LLVM Exceptions.                      *\
+ *  SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception.                 *\
+ *  See https://llvm.org/LICENSE.txt for license information.                *\
+ *                                                                           *\
+ *  Copyright (c) 2019-2022                                                  *\
+ *     Verificarlo Contributors                                              *\
+ *                                                                           *\
+ ****************************************************************************/
+
+#ifndef __INTERFLOP_CANCELLATION_STATS_H__
+#define __INTERFLOP_CANCELLATION_STATS_H__
+
+#include <stdint.h>
+
+/* Live counters published with --stats.
+ *
+ * The backend creates the POSIX shared-memory segment named after
+ * CANCELLATION_STATS_NAME_FORMAT and the pid of the process, and removes it
+ * at finalize. Each thread owns a slot of the segment, which it updates with
+ * relaxed stores; a reader attaches read-only and sums the slots with
+ * relaxed loads, see cancellation_stats. */
+
+#define CANCELLATION_STATS_NAME_FORMAT "/interflop_cancellation.%d"
+#define CANCELLATION_STATS_MAGIC "IFCSTATS"
+#define CANCELLATION_STATS_VERSION 1
+/* Number of thread slots, the threads beyond are not published */
+#define CANCELLATION_STATS_THREADS 512
+/* Number of cancellation sizes counted, the last one counts the
+ * cancellations larger than the binary64 significand */
+#define CANCELLATION_STATS_SIZES 54
+
+/* counters of a thread, on their own cache lines */
+typedef struct {
+  /* additions, subtractions and FMAs executed */
+  uint64_t operations;
+  /* noises added to results */
+  uint64_t noises;
+  /* cancellations at least as large as the tolerance, by size */
+  uint64_t events[CANCELLATION_STATS_SIZES];
+  uint32_t tid;
+} __attribute__((aligned(64))) cancellation_stats_thread_t;
+
+typedef struct {
+  /* CANCELLATION_STATS_MAGIC, without the terminating null byte */
+  char magic[8];
+  uint32_t version;
+  uint32_t max_threads;
+  /* number of slots claimed, may exceed max_threads */
+  uint64_t threads;
+  cancellation_stats_thread_t thread[CANCELLATION_STATS_THREADS];
+} cancellation_stats_t;
+
+#endif /* __INTERFLOP_CANCELLATION_STATS_H__ */
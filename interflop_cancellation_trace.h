@@ -0,0 +1,67 @@
+/*****************************************************************************\
+ *                                                                           *\
+ *  This file is part of the Verificarlo project,                            *\
+ *  under the Apache License v2.0 with LLVM Exceptions.                      *\
+ *  SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception.                 *\
+ *  See https://llvm.org/LICENSE.txt for license information.                *\
+ *                                                                           *\
+ *  Copyright (c) 2019-2022                                                  *\
+ *     Verificarlo Contributors                                              *\
+ *                                                                           *\
+ ****************************************************************************/
+
+#ifndef __INTERFLOP_CANCELLATION_TRACE_H__
+#define __INTERFLOP_CANCELLATION_TRACE_H__
+
+#include <stdint.h>
+
+/* Binary event trace written with --trace=FILE.
+ *
+ * The file starts with a header of CANCELLATION_TRACE_HEADER_SIZE bytes,
+ * followed by chunks of chunk_records records. A chunk is filled by a single
+ * thread, in the order of its events; the records at the end of a chunk that
+ * are all zeros are unused. Integers are in the byte order of the host that
+ * wrote the trace.
+ *
+ * The names of the functions are written at finalize to FILE.functions, one
+ * "id,name" line per function. */
+
+#define CANCELLATION_TRACE_MAGIC "IFCTRACE"
+#define CANCELLATION_TRACE_VERSION 1
+#define CANCELLATION_TRACE_HEADER_SIZE 4096
+
+typedef struct {
+  /* CANCELLATION_TRACE_MAGIC, without the terminating null byte */
+  char magic[8];
+  uint32_t version;
+  /* sizeof(cancellation_trace_record_t) */
+  uint32_t record_size;
+  uint64_t chunk_records;
+} cancellation_trace_header_t;
+
+/* Operation of a traced cancellation, never 0 */
+typedef enum {
+  cancellation_trace_op_add_sub = 1,
+  cancellation_trace_op_fma = 2,
+} cancellation_trace_op_t;
+
+/* Exponent of a zero operand */
+#define CANCELLATION_TRACE_EXPONENT_ZERO INT16_MIN
+
+/* One cancellation larger than the tolerance */
+typedef struct {
+  uint32_t tid;
+  /* identifier of the function, 0 outside of instrumented functions */
+  uint32_t function;
+  /* exponents of the cancelling terms: the operands of an addition or a
+   * subtraction, the exact product and the addend of an FMA */
+  int16_t e_x;
+  int16_t e_y;
+  /* cancellation_trace_op_t */
+  uint8_t op;
+  /* 32 or 64 */
+  uint8_t precision;
+  uint16_t size;
+} cancellation_trace_record_t;
+
+#endif /* __INTERFLOP_CANCELLATION_TRACE_H__ */
@@ -0,0 +1,125 @@
+/*****************************************************************************\
+ *                                                                           *\
+ *  This file is part of the Verificarlo project,                            *\
+ *  under the Apache License v2.0 with LLVM Exceptions.                      *\
+ *  SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception.                 *\
+ *  See https://llvm.org/LICENSE.txt for license information.                *\
+ *                                                                           *\
+ *  Copyright (c) 2019-2022                                                  *\
+ *     Verificarlo Contributors                                              *\
+ *                                                                           *\
+ ****************************************************************************/
+// Prints the live counters of a process running with --stats: the
+// operations, the noises and the cancellations by size, summed over its
+// threads. With an interval, the counters are printed every INTERVAL
+// seconds, with their rates over the interval, until the process exits.
+//
+// Usage: cancellation_stats PID [INTERVAL]
+
+#include <err.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "interflop_cancellation_stats.h"
+
+typedef struct {
+  uint64_t threads;
+  uint64_t operations;
+  uint64_t noises;
+  uint64_t events[CANCELLATION_STATS_SIZES];
+} stats_total_t;
+
+static void _sum(const cancellation_stats_t *segment, stats_total_t *total) {
+  *total = (stats_total_t){0};
+  total->threads = __atomic_load_n(&segment->threads, __ATOMIC_RELAXED);
+  const uint64_t threads = (total->threads < segment->max_threads)
+                               ? total->threads
+                               : segment->max_threads;
+  for (uint64_t t = 0; t < threads; t++) {
+    const cancellation_stats_thread_t *slot = &segment->thread[t];
+    total->operations += __atomic_load_n(&slot->operations, __ATOMIC_RELAXED);
+    total->noises += __atomic_load_n(&slot->noises, __ATOMIC_RELAXED);
+    for (int i = 0; i < CANCELLATION_STATS_SIZES; i++) {
+      total->events[i] += __atomic_load_n(&slot->events[i], __ATOMIC_RELAXED);
+    }
+  }
+}
+
+static void _print(const stats_total_t *total, const stats_total_t *last,
+                   const double interval) {
+  uint64_t events = 0;
+  for (int i = 0; i < CANCELLATION_STATS_SIZES; i++) {
+    events += total->events[i];
+  }
+  printf("threads %lu, operations %lu, cancellations %lu, noises %lu\n",
+         total->threads, total->operations, events, total->noises);
+  if (last != NULL) {
+    uint64_t last_events = 0;
+    for (int i = 0; i < CANCELLATION_STATS_SIZES; i++) {
+      last_events += last->events[i];
+    }
+    printf("  %.3g operations/s, %.3g cancellations/s\n",
+           (total->operations - last->operations) / interval,
+           (events - last_events) / interval);
+  }
+  for (int i = 0; i < CANCELLATION_STATS_SIZES; i++) {
+    if (total->events[i] == 0) {
+      continue;
+    }
+    if (i == CANCELLATION_STATS_SIZES - 1) {
+      printf("  size >%d: %lu\n", i - 1, total->events[i]);
+    } else {
+      printf("  size %d: %lu\n", i, total->events[i]);
+    }
+  }
+  fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "usage: %s PID [INTERVAL]\n", argv[0]);
+    return 1;
+  }
+  const int pid = atoi(argv[1]);
+  const double interval = (argc > 2) ? atof(argv[2]) : 0;
+
+  char name[64];
+  snprintf(name, sizeof(name), CANCELLATION_STATS_NAME_FORMAT, pid);
+  const int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    err(1, "cannot attach to %s, is process %d running with --stats", name,
+        pid);
+  }
+  const cancellation_stats_t *segment = mmap(
+      NULL, sizeof(cancellation_stats_t), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (segment == MAP_FAILED) {
+    err(1, "cannot map %s", name);
+  }
+  if (memcmp(segment->magic, CANCELLATION_STATS_MAGIC,
+             sizeof(segment->magic)) != 0) {
+    errx(1, "%s is not ready or is not a cancellation stats segment", name);
+  }
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (segment->version != CANCELLATION_STATS_VERSION) {
+    errx(1, "%s: unsupported version %u", name, segment->version);
+  }
+
+  stats_total_t total, last;
+  _sum(segment, &total);
+  _print(&total, NULL, 0);
+  /* the mapping stays valid after the segment is removed at finalize */
+  while (interval > 0 && kill(pid, 0) == 0) {
+    usleep((useconds_t)(interval * 1e6));
+    last = total;
+    _sum(segment, &total);
+    _print(&total, &last, interval);
+  }
+  return 0;
+}
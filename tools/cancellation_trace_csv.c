@@ -0,0 +1,160 @@
+/*****************************************************************************\
+ *                                                                           *\
+ *  This file is part of the Verificarlo project,                            *\
+ *  under the Apache License v2.0 with LLVM Exceptions.                      *\
+ *  SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception.                 *\
+ *  See https://llvm.org/LICENSE.txt for license information.                *\
+ *                                                                           *\
+ *  Copyright (c) 2019-2022                                                  *\
+ *     Verificarlo Contributors                                              *\
+ *                                                                           *\
+ ****************************************************************************/
+// Converts a binary trace written with --trace=FILE to CSV on the standard
+// output, one line per cancellation:
+//
+//   tid,function,op,precision,size,e_x,e_y
+//
+// The function is given by its name when FILE.functions is found, by its
+// identifier otherwise, and is empty outside of instrumented functions. The
+// exponent of a zero operand is empty. The records are written chunk by
+// chunk, so the events of a thread are in order but the threads are
+// interleaved.
+//
+// Usage: cancellation_trace_csv FILE
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "interflop_cancellation_trace.h"
+
+/* records read at once */
+#define READ_RECORDS 4096
+
+typedef struct {
+  uint32_t id;
+  char *name;
+} function_name_t;
+
+static function_name_t *functions = NULL;
+static size_t functions_size = 0;
+
+static int _compare_functions(const void *x, const void *y) {
+  const uint32_t a = ((const function_name_t *)x)->id;
+  const uint32_t b = ((const function_name_t *)y)->id;
+  return (a > b) - (a < b);
+}
+
+/* Loads the names of the functions from path, if it exists */
+static void _load_functions(const char *path) {
+  FILE *stream = fopen(path, "r");
+  if (stream == NULL) {
+    return;
+  }
+  size_t capacity = 0;
+  char line[4096];
+  /* skip the "id,name" header */
+  if (fgets(line, sizeof(line), stream) == NULL) {
+    fclose(stream);
+    return;
+  }
+  while (fgets(line, sizeof(line), stream) != NULL) {
+    char *name = strchr(line, ',');
+    if (name == NULL) {
+      continue;
+    }
+    *name++ = '\0';
+    name[strcspn(name, "\n")] = '\0';
+    if (functions_size == capacity) {
+      capacity = (capacity == 0) ? 256 : 2 * capacity;
+      functions = realloc(functions, capacity * sizeof(function_name_t));
+      if (functions == NULL) {
+        err(1, "cannot load %s", path);
+      }
+    }
+    functions[functions_size++] =
+        (function_name_t){(uint32_t)strtoul(line, NULL, 10), strdup(name)};
+  }
+  fclose(stream);
+  qsort(functions, functions_size, sizeof(function_name_t),
+        _compare_functions);
+}
+
+static const char *_function_name(const uint32_t id) {
+  const function_name_t key = {id, NULL};
+  const function_name_t *f =
+      bsearch(&key, functions, functions_size, sizeof(function_name_t),
+              _compare_functions);
+  return (f == NULL) ? NULL : f->name;
+}
+
+static void _print_exponent(const int16_t e) {
+  if (e != CANCELLATION_TRACE_EXPONENT_ZERO) {
+    printf("%d", e);
+  }
+}
+
+static void _print_record(const cancellation_trace_record_t *r) {
+  printf("%u,", r->tid);
+  if (r->function != 0) {
+    const char *name = _function_name(r->function);
+    if (name != NULL) {
+      printf("%s", name);
+    } else {
+      printf("%u", r->function);
+    }
+  }
+  printf(",%s,binary%u,%u,",
+         (r->op == cancellation_trace_op_fma) ? "fma" : "add_sub",
+         r->precision, r->size);
+  _print_exponent(r->e_x);
+  printf(",");
+  _print_exponent(r->e_y);
+  printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s FILE\n", argv[0]);
+    return 1;
+  }
+  const char *path = argv[1];
+  FILE *stream = fopen(path, "rb");
+  if (stream == NULL) {
+    err(1, "cannot open %s", path);
+  }
+
+  char header[CANCELLATION_TRACE_HEADER_SIZE];
+  const cancellation_trace_header_t *h =
+      (const cancellation_trace_header_t *)header;
+  if (fread(header, sizeof(header), 1, stream) != 1 ||
+      memcmp(h->magic, CANCELLATION_TRACE_MAGIC, sizeof(h->magic)) != 0) {
+    errx(1, "%s is not a cancellation trace", path);
+  }
+  if (h->version != CANCELLATION_TRACE_VERSION ||
+      h->record_size != sizeof(cancellation_trace_record_t)) {
+    errx(1, "%s: unsupported trace version %u (record size %u)", path,
+         h->version, h->record_size);
+  }
+
+  char *functions_path = malloc(strlen(path) + sizeof(".functions"));
+  sprintf(functions_path, "%s.functions", path);
+  _load_functions(functions_path);
+  free(functions_path);
+
+  printf("tid,function,op,precision,size,e_x,e_y\n");
+  cancellation_trace_record_t records[READ_RECORDS];
+  size_t n;
+  while ((n = fread(records, sizeof(records[0]), READ_RECORDS, stream)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      /* unused records at the end of the chunks */
+      if (records[i].op != 0) {
+        _print_record(&records[i]);
+      }
+    }
+  }
+  fclose(stream);
+  return 0;
+}